@@ -1,11 +1,38 @@
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <fstream>
 #include <vector>
 #include <algorithm>
 #include <cstring>
 #include <map>
 #include <chrono>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <queue>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+#include <cstdlib>
+#include <cmath>
+#include <random>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#endif
 
 typedef unsigned long long U64;
 
@@ -13,14 +40,32 @@ typedef unsigned long long U64;
 enum { PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING };
 // Enum for colors
 enum { WHITE, BLACK };
+// Mailbox code for an empty square (occupied squares hold color * 6 + piece)
+const int NO_PIECE = 12;
 
 const int INF = 999999;
 const int MATE = 100000;
 const int MAX_QUIESCENCE_DEPTH = 6;
 const int MAX_PLY = 128;
+const int MAX_THREADS = 64;
+
+struct Move {
+    int from, to, score;
+    int piece, captured, promo;
+
+    Move(int f = 0, int t = 0, int p = 0, int c = -1, int pr = 0)
+        : from(f), to(t), piece(p), captured(c), promo(pr), score(0) {}
+        
+    bool operator==(const Move& other) const {
+        return from == other.from && to == other.to && promo == other.promo;
+    }
+};
 
 // Bitboard masks
 U64 KingMoves[64], KnightMoves[64];
+U64 PawnAttacks[2][64];
+U64 RookRays[64], BishopRays[64]; // Empty-board slider attacks
+U64 Between[64][64], Line[64][64];
 
 // Search optimization structures
 struct HistoryTable {
@@ -44,121 +89,673 @@ struct HistoryTable {
     int get(int side, int from, int to) {
         return scores[side][from][to];
     }
-} historyTable;
+};
+thread_local HistoryTable historyTable; // One per search thread
 
 struct KillerMoves {
-    struct Move* killers[MAX_PLY][2];
+    Move killers[MAX_PLY][2];
     
     void init() {
-        memset(killers, 0, sizeof(killers));
+        for (int ply = 0; ply < MAX_PLY; ply++)
+            killers[ply][0] = killers[ply][1] = Move();
     }
     
-    void update(struct Move* m, int ply) {
-        if (killers[ply][0] != m) {
+    void update(const Move& m, int ply) {
+        if (!(killers[ply][0] == m)) {
             killers[ply][1] = killers[ply][0];
             killers[ply][0] = m;
         }
     }
     
-    bool isKiller(struct Move* m, int ply) {
+    bool isKiller(const Move& m, int ply) {
         return killers[ply][0] == m || killers[ply][1] == m;
     }
-} killerMoves;
+};
+thread_local KillerMoves killerMoves; // One per search thread
 
-// Transposition Table
+// Transposition Table. Entries are shared by all search threads without
+// locks: the key is stored XORed with the data, so a torn entry written
+// by two threads at once fails the hash check instead of being trusted.
 struct TTEntry {
-    U64 hash;
+    U64 key;  // hash ^ data
+    U64 data; // score:32 | depth:8 | flag:2 | bestMove:18
+};
+
+struct TTData {
     int depth;
     int score;
     int flag; // EXACT, ALPHA, BETA
     int bestMove;
 };
 
-const int TT_SIZE = 1 << 20; // 1MB entries
-TTEntry transpositionTable[TT_SIZE];
+// Table storage: private heap memory, or with SharedHash a POSIX shared
+// memory segment mapped by every engine process on the host. The XORed
+// keys make concurrent writers in other processes as harmless as threads.
+TTEntry* transpositionTable = nullptr;
+U64 ttMask = 0;     // Entry count - 1 (a power of two)
+bool ttShared = false;
+
+size_t ttBytes() {
+    return transpositionTable ? (size_t)(ttMask + 1) * sizeof(TTEntry) : 0;
+}
+
+void ttFree(TTEntry* table, U64 mask, bool shared) {
+#ifndef _WIN32
+    if (shared) munmap(table, (mask + 1) * sizeof(TTEntry));
+    else
+#endif
+    free(table);
+    (void)mask;
+    (void)shared;
+}
+
+void ttRelease() {
+    if (!transpositionTable) return;
+    ttFree(transpositionTable, ttMask, ttShared);
+    transpositionTable = nullptr;
+    ttShared = false;
+}
+
+// Map the host-wide segment for this size, creating it zeroed if needed.
+// It outlives the process so the next engine starts with a warm table.
+TTEntry* ttMapShared(size_t bytes) {
+#ifndef _WIN32
+    std::string name = "/NanoChessTurbo-tt-" + std::to_string(bytes >> 20);
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+    if (fd < 0) return nullptr;
+    void* p = MAP_FAILED;
+    if (ftruncate(fd, bytes) == 0) {
+        p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (p != MAP_FAILED) return (TTEntry*)p;
+#endif
+    (void)bytes;
+    return nullptr;
+}
+
+// Runs task(index, count) on every pool thread and waits (see ThreadPool)
+void runOnPool(const std::function<void(int, int)>& task);
+
+// Move the entries of part 'index' of 'count' into a table of another size.
+// Growing, each old slot has its own new slot; shrinking, each new slot
+// takes the deepest of the old slots folding onto it. Parts never write
+// the same slot, and an existing deeper entry (a shared table) is kept.
+void ttRehash(const TTEntry* from, U64 fromMask, TTEntry* to, U64 toMask, int index, int count) {
+    auto depthOf = [](const TTEntry& e) { return (int)(e.data >> 32 & 0xFF); };
+    auto keep = [&](TTEntry& target, const TTEntry& e) {
+        if (!target.data || depthOf(target) <= depthOf(e)) target = e;
+    };
+    // Empty slots and torn entries do not hash back to their own slot
+    auto valid = [&](U64 slot) { return from[slot].data && ((from[slot].key ^ from[slot].data) & fromMask) == slot; };
+    
+    U64 slots = std::min(fromMask, toMask) + 1;
+    U64 begin = slots * index / count, end = slots * (index + 1) / count;
+    for (U64 slot = begin; slot < end; slot++) {
+        if (toMask >= fromMask) {
+            if (valid(slot)) keep(to[(from[slot].key ^ from[slot].data) & toMask], from[slot]);
+            continue;
+        }
+        const TTEntry* best = nullptr;
+        for (U64 old = slot; old <= fromMask; old += toMask + 1) {
+            if (valid(old) && (!best || depthOf(from[old]) > depthOf(*best))) best = &from[old];
+        }
+        if (best) keep(to[slot], *best);
+    }
+}
+
+// Size the table to the largest power of two entries that fits in 'mb'.
+// What the old table learned is rehashed into the new one by all threads.
+void ttResize(int mb, bool shared) {
+    U64 entries = 1;
+    while (entries * 2 * sizeof(TTEntry) <= (U64)mb << 20) entries *= 2;
+    size_t bytes = entries * sizeof(TTEntry);
+    if (transpositionTable && ttShared == shared && ttMask + 1 == entries) return;
+    
+    TTEntry* table = nullptr;
+    bool mapped = false;
+    if (shared) {
+        table = ttMapShared(bytes);
+        mapped = table != nullptr;
+        if (!mapped) std::cout << "info string SharedHash unavailable, using a private table\n";
+    }
+    if (!table) {
+        table = (TTEntry*)calloc(entries, sizeof(TTEntry));
+    }
+    
+    if (transpositionTable) {
+        TTEntry* old = transpositionTable;
+        U64 oldMask = ttMask;
+        runOnPool([=](int index, int count) { ttRehash(old, oldMask, table, entries - 1, index, count); });
+        ttRelease();
+    }
+    transpositionTable = table;
+    ttShared = mapped;
+    ttMask = entries - 1;
+}
 
 enum { TT_EXACT, TT_ALPHA, TT_BETA };
 
+// Private writes of a thread in deterministic mode, keyed by full hash.
+// The shared table is read-only while overlays are active; they are
+// merged into it in thread order once every thread has finished.
+typedef std::unordered_map<U64, U64> TTOverlay;
+const size_t TT_OVERLAY_LIMIT = 1 << 18;
+thread_local TTOverlay* ttOverlay = nullptr;
+
+void ttDecode(U64 data, TTData& d) {
+    d.score = (int)(uint32_t)data;
+    d.depth = (data >> 32) & 0xFF;
+    d.flag = (data >> 40) & 3;
+    d.bestMove = (data >> 42) & 0x3FFFF;
+}
+
+// Per-thread first level for shallow entries, sized to stay in a core's
+// L2 cache. Entries below l1Depth live only here, so near-leaf results
+// never evict deep ones from the shared table or cross sockets (0: off).
+const int L1_SIZE = 1 << 14; // 16K entries, 256 KB
+
+struct L1Table {
+    TTEntry entries[L1_SIZE];
+};
+
+L1Table* l1Tables[MAX_THREADS]; // Allocated only while l1Depth is set
+thread_local TTEntry* l1Table = nullptr;
+int l1Depth = 0;
+
+void l1Clear() {
+    if (l1Table) memset(l1Table, 0, sizeof(L1Table));
+}
+
+// The calling pool thread's table, allocated if L1 is on and it has none
+void l1Attach(int index) {
+    if (l1Depth && !l1Tables[index]) l1Tables[index] = (L1Table*)calloc(1, sizeof(L1Table));
+    l1Table = l1Depth && l1Tables[index] ? l1Tables[index]->entries : nullptr;
+}
+
+// Apply a new L1HashDepth: fresh tables for every thread, or none when off.
+// The shared table keeps its entries.
+void l1Setup(int depth) {
+    l1Depth = depth;
+    runOnPool([](int index, int) {
+        l1Attach(index);
+        l1Clear();
+    });
+    if (l1Depth) return;
+    for (int i = 0; i < MAX_THREADS; i++) {
+        free(l1Tables[i]);
+        l1Tables[i] = nullptr;
+    }
+}
+
+bool ttProbe(U64 hash, TTData& d, int depth = MAX_PLY) {
+    if (ttOverlay) {
+        auto it = ttOverlay->find(hash);
+        if (it != ttOverlay->end()) {
+            ttDecode(it->second, d);
+            return true;
+        }
+    }
+    if (depth < l1Depth && l1Table) {
+        const TTEntry& e = l1Table[hash & (L1_SIZE - 1)];
+        U64 data = e.data;
+        if ((e.key ^ data) == hash) {
+            ttDecode(data, d);
+            return true;
+        }
+    }
+    const TTEntry& e = transpositionTable[hash & ttMask];
+    U64 data = e.data;
+    if ((e.key ^ data) != hash) return false;
+    ttDecode(data, d);
+    return true;
+}
+
+void ttWrite(U64 hash, U64 data) {
+    TTEntry& e = transpositionTable[hash & ttMask];
+    e.key = hash ^ data;
+    e.data = data;
+}
+
+// First number in a file, or 0 when it is missing or says "max"
+U64 readNumber(const std::string& path) {
+    std::ifstream in(path.c_str());
+    U64 value = 0;
+    in >> value;
+    return in ? value : 0;
+}
+
+// Memory this process may still use, in bytes: the tighter of its cgroup
+// limit (v2 memory.max minus memory.current, or v1 limit_in_bytes) and
+// the host's MemAvailable. 'limit' receives the cgroup limit, 0 if none.
+U64 availableMemory(U64& limit) {
+    std::string group = "/sys/fs/cgroup";
+    std::ifstream cgroup("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(cgroup, line)) {
+        if (line.compare(0, 3, "0::") == 0 && line.size() > 4) group += line.substr(3);
+    }
+    limit = readNumber(group + "/memory.max");
+    U64 used = readNumber(group + "/memory.current");
+    if (!limit) limit = readNumber("/sys/fs/cgroup/memory.max");
+    if (!limit) {
+        limit = readNumber("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+        used = readNumber("/sys/fs/cgroup/memory/memory.usage_in_bytes");
+        if (limit >= (1ULL << 60)) limit = 0; // v1 reports "unlimited" as a huge number
+    }
+    
+    U64 host = 0;
+    std::ifstream meminfo("/proc/meminfo");
+    std::string key;
+    while (meminfo >> key) {
+        if (key == "MemAvailable:") {
+            meminfo >> host;
+            host <<= 10;
+            break;
+        }
+        meminfo.ignore(256, '\n');
+    }
+    
+    U64 free = host;
+    if (limit) free = std::min(free, limit > used ? limit - used : 0);
+    return free;
+}
+
+// Deep entries waiting to be streamed to cluster peers (0: not clustered)
+int clusterShareDepth = 0;
+std::mutex ttOutboxLock;
+std::vector<std::pair<U64, U64> > ttOutbox;
+
+void ttStore(U64 hash, int depth, int score, int flag, int bestMove) {
+    U64 data = (U64)(uint32_t)score | ((U64)depth << 32) | ((U64)flag << 40) | ((U64)bestMove << 42);
+    if (ttOverlay) {
+        // A full overlay drops new positions; the limit is part of the schedule
+        if (ttOverlay->size() < TT_OVERLAY_LIMIT || ttOverlay->count(hash)) (*ttOverlay)[hash] = data;
+        return;
+    }
+    if (depth < l1Depth && l1Table) {
+        TTEntry& e = l1Table[hash & (L1_SIZE - 1)];
+        e.key = hash ^ data;
+        e.data = data;
+        return;
+    }
+    ttWrite(hash, data);
+    if (clusterShareDepth && depth >= clusterShareDepth) {
+        std::lock_guard<std::mutex> guard(ttOutboxLock);
+        ttOutbox.push_back(std::make_pair(hash, data));
+    }
+}
+
+// Fold an overlay into the shared table in key order, then empty it
+void ttCommit(TTOverlay& overlay) {
+    std::vector<std::pair<U64, U64> > entries(overlay.begin(), overlay.end());
+    std::sort(entries.begin(), entries.end());
+    for (const auto& e : entries) ttWrite(e.first, e.second);
+    overlay.clear();
+}
+
+void ttClear() {
+    // Other processes rely on a shared table; it is never wiped
+    if (transpositionTable && !ttShared) memset(transpositionTable, 0, ttBytes());
+}
+
+// TT move encoding: from | to << 6 | piece << 12 | promo << 15
+int packMove(const Move& m) {
+    return m.from | (m.to << 6) | (m.piece << 12) | (m.promo << 15);
+}
+
+Move unpackMove(int packed) {
+    return Move(packed & 63, (packed >> 6) & 63, (packed >> 12) & 7, -1, (packed >> 15) & 7);
+}
+
+// Long algebraic notation for UCI output
+std::string moveToString(const Move& m) {
+    std::string s;
+    s += (m.from % 8) + 'a';
+    s += (m.from / 8) + '1';
+    s += (m.to % 8) + 'a';
+    s += (m.to / 8) + '1';
+    switch (m.promo) {
+        case QUEEN: s += 'q'; break;
+        case ROOK: s += 'r'; break;
+        case BISHOP: s += 'b'; break;
+        case KNIGHT: s += 'n'; break;
+    }
+    return s;
+}
+
 // UCI Options
 struct UCIOptions {
     int depth;
     bool useQuiescence;
     int quiescenceDepth;
+    int threads;
+    bool deterministic;
+    int hashMB;
+    bool sharedHash;
+    bool autoHash;
+    int autoHashPercent;
+    int nodesTime; // Nodes per millisecond of clock time (0: real time)
+    std::string bookFile; // makebook output to play from (empty: none)
     
-    UCIOptions() : depth(8), useQuiescence(true), quiescenceDepth(4) {}
+    UCIOptions() : depth(8), useQuiescence(true), quiescenceDepth(4), threads(1), deterministic(false),
+                   hashMB(64), sharedHash(false), autoHash(false), autoHashPercent(50), nodesTime(0) {}
 } uciOptions;
 
-// Statistics
+// With nodestime the engine keeps its own clock in nodes: it starts from
+// the first wtime/btime of a game, gains nodestime per increment ms and
+// loses the nodes each search takes, so the GUI's wall clock is ignored.
+long long availableNodes = 0;
+int clockNodesPerMs = 0; // Set for a search whose clock runs on nodes
+
+// "stop" and "quit" lines the input reader has queued but the UCI loop has
+// not reached yet. Searches that block the loop poll this to end early.
+std::atomic<int> pendingStops(0);
+std::atomic<bool> stopArmed(false); // Set while go searches: only then does a stop end search()
+
+// Search constants, settable as UCI options and tuned by spsa. Threads
+// search with *params: the engine's searchParams, or a perturbed copy
+// while spsa plays its games.
+struct SearchParams {
+    int aspirationWindow;  // Aspiration half-width, initial and after a fail
+    int aspirationNarrow;  // Half-width after a search inside the window
+    int nullReduction;     // Null move R
+    int nullReductionDeep; // Null move R above depth 6
+    int lmrMoves1, lmrMoves2, lmrMoves3; // Reduce 1/2/3 plies after this many moves
+    int futilityMargin;    // Per ply of depth
+    int deltaPawn;         // Quiescence delta pruning: expected gain of a pawn capture
+    int deltaPiece;        // ... and of a piece capture
+    
+    SearchParams() : aspirationWindow(50), aspirationNarrow(25), nullReduction(2), nullReductionDeep(3),
+                     lmrMoves1(4), lmrMoves2(6), lmrMoves3(12), futilityMargin(100), deltaPawn(200),
+                     deltaPiece(900) {}
+} searchParams;
+
+thread_local const SearchParams* params = &searchParams;
+
+struct ParamSpec {
+    const char* name;
+    int SearchParams::*field;
+    int min, max;
+    double step; // SPSA perturbation at the first iteration
+};
+
+const ParamSpec paramSpecs[] = {
+    {"AspirationWindow", &SearchParams::aspirationWindow, 10, 200, 10},
+    {"AspirationNarrow", &SearchParams::aspirationNarrow, 5, 100, 5},
+    {"NullReduction", &SearchParams::nullReduction, 1, 4, 0.5},
+    {"NullReductionDeep", &SearchParams::nullReductionDeep, 1, 5, 0.5},
+    {"LmrMoves1", &SearchParams::lmrMoves1, 1, 10, 1},
+    {"LmrMoves2", &SearchParams::lmrMoves2, 2, 20, 1.5},
+    {"LmrMoves3", &SearchParams::lmrMoves3, 3, 40, 2.5},
+    {"FutilityMargin", &SearchParams::futilityMargin, 20, 400, 15},
+    {"DeltaPawn", &SearchParams::deltaPawn, 50, 600, 25},
+    {"DeltaPiece", &SearchParams::deltaPiece, 200, 1500, 60},
+};
+const int PARAM_COUNT = sizeof(paramSpecs) / sizeof(paramSpecs[0]);
+
+// Set a search parameter from its option value; false if no such parameter
+bool setParam(const std::string& name, std::istream& value) {
+    for (const ParamSpec& spec : paramSpecs) {
+        if (name != spec.name) continue;
+        int v;
+        if (value >> v) searchParams.*spec.field = std::max(spec.min, std::min(spec.max, v));
+        return true;
+    }
+    return false;
+}
+
+// Size the TT from Hash, or with AutoHash from a share of the memory this
+// process may still use; the resulting layout is reported
+void applyHash() {
+    if (!uciOptions.autoHash) {
+        ttResize(uciOptions.hashMB, uciOptions.sharedHash);
+        return;
+    }
+    U64 limit;
+    U64 budget = (availableMemory(limit) + ttBytes()) / 100 * uciOptions.autoHashPercent;
+    int mb = (int)std::max<U64>(1, std::min<U64>(1024, budget >> 20));
+    ttResize(mb, uciOptions.sharedHash);
+    
+    std::cout << "info string AutoHash cgroup limit ";
+    if (limit) std::cout << (limit >> 20) << " MB";
+    else std::cout << "none";
+    std::cout << " budget " << (budget >> 20) << " MB (" << uciOptions.autoHashPercent << "%)"
+              << " tt " << (ttBytes() >> 20) << " MB " << ttMask + 1 << " entries"
+              << (ttShared ? " shared" : "")
+              << " history+killers " << (sizeof(HistoryTable) + sizeof(KillerMoves)) / 1024 << " KB x "
+              << uciOptions.threads << " threads\n";
+}
+
+// Counter written by one thread only: a relaxed load/store pair is a plain
+// increment, and readers on other threads still see a well-defined value
+struct Counter {
+    std::atomic<long long> value;
+    
+    void inc() { value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+    void max(long long v) { if (v > value.load(std::memory_order_relaxed)) value.store(v, std::memory_order_relaxed); }
+    long long get() const { return value.load(std::memory_order_relaxed); }
+    void clear() { value.store(0, std::memory_order_relaxed); }
+};
+
+// Per-thread statistics, one cache line each so the hottest writes in the
+// engine never bounce between cores. tbhits stays 0: there are no tablebases.
+struct alignas(64) ThreadStats {
+    Counter nodes, qnodes, tbhits, ttHits, seldepth;
+    
+    void clear() {
+        nodes.clear(); qnodes.clear(); tbhits.clear(); ttHits.clear(); seldepth.clear();
+    }
+};
+
+static_assert(sizeof(ThreadStats) == 64, "ThreadStats must fill exactly one cache line");
+
+ThreadStats threadStats[MAX_THREADS];
+thread_local ThreadStats* localStats = &threadStats[0];
+
+// Search-wide statistics, summed over the threads only when reported
 struct SearchStats {
-    long long nodes;
-    long long qnodes;
     int currentDepth;
     std::chrono::steady_clock::time_point startTime;
     
     void init() {
-        nodes = 0;
-        qnodes = 0;
+        for (int i = 0; i < MAX_THREADS; i++) threadStats[i].clear();
         currentDepth = 0;
         startTime = std::chrono::steady_clock::now();
     }
     
-    long long nps() {
+    long long sum(Counter ThreadStats::*field) const {
+        long long total = 0;
+        for (int i = 0; i < MAX_THREADS; i++) total += (threadStats[i].*field).get();
+        return total;
+    }
+    
+    long long nodes() const { return sum(&ThreadStats::nodes); }
+    long long qnodes() const { return sum(&ThreadStats::qnodes); }
+    long long tbhits() const { return sum(&ThreadStats::tbhits); }
+    long long ttHits() const { return sum(&ThreadStats::ttHits); }
+    
+    int seldepth() const {
+        long long deepest = 0;
+        for (int i = 0; i < MAX_THREADS; i++) deepest = std::max(deepest, threadStats[i].seldepth.get());
+        return (int)deepest;
+    }
+    
+    long long nps() const {
         auto elapsed = std::chrono::steady_clock::now() - startTime;
         auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
         if (ms == 0) return 0;
-        return (nodes + qnodes) * 1000 / ms;
+        return (nodes() + qnodes()) * 1000 / ms;
     }
 } searchStats;
 
+// A stop queued while go searches ends it once the first iteration is done
+bool stopRequested() {
+    return stopArmed.load(std::memory_order_relaxed) && searchStats.currentDepth > 1 &&
+           pendingStops.load(std::memory_order_relaxed) > 0;
+}
+
 // Forward declarations
 struct Board;
-struct Move;
 bool is_attacked(int sq, int side, const Board& b);
 void makeMove(Board& b, const Move& m);
+void setCheckInfo(Board& b);
 bool isInCheck(const Board& b);
-bool isLegalMove(Board& b, const Move& m);
+bool isLegal(const Board& b, const Move& m);
 U64 get_rook_attacks(int sq, U64 blockers);
+void sliderAttacks(const U64 rooks[2], const U64 bishops[2], U64 occupied, U64 attacks[2]);
 U64 get_bishop_attacks(int sq, U64 blockers);
 U64 zobristHash(const Board& b);
 
-// Board representation
-struct Board {
-    U64 pieces[2][6];
-    U64 occupied[2];
-    U64 all;
-    int side, ep, castle;
+// Board representation: hot bitboards in the first cache line,
+// hash, state bytes and check info in the second, mailbox in the third
+struct alignas(64) Board {
+    U64 byType[6];
+    U64 byColor[2];
+
     U64 hash;
+    U64 checkers;        // Enemy pieces giving check to the side to move
+    U64 checkSq[4];      // Squares from which PAWN..ROOK would check the enemy king
+    U64 pinned;          // Our pieces pinned to our king
+    uint8_t side, castle, rule50;
+    int8_t ep;
+
+    uint8_t squares[64]; // Mailbox kept in sync with the bitboards
+
+    U64 pieces(int c, int p) const { return byType[p] & byColor[c]; }
+    U64 occupied(int c) const { return byColor[c]; }
+    U64 all() const { return byColor[WHITE] | byColor[BLACK]; }
+
+    U64 checkSquares(int p) const {
+        if (p == QUEEN) return checkSq[BISHOP] | checkSq[ROOK];
+        return p == KING ? 0 : checkSq[p];
+    }
+
+    // Add or remove pieces of one kind
+    void toggle(int c, int p, U64 bb) {
+        byType[p] ^= bb;
+        byColor[c] ^= bb;
+    }
 
     void init() {
-        memset(pieces, 0, sizeof(pieces));
-        pieces[WHITE][PAWN]   = 0xFF00ULL;
-        pieces[WHITE][KNIGHT] = 0x42ULL;
-        pieces[WHITE][BISHOP] = 0x24ULL;
-        pieces[WHITE][ROOK]   = 0x81ULL;
-        pieces[WHITE][QUEEN]  = 0x8ULL;
-        pieces[WHITE][KING]   = 0x10ULL;
-
-        pieces[BLACK][PAWN]   = 0xFF000000000000ULL;
-        pieces[BLACK][KNIGHT] = 0x4200000000000000ULL;
-        pieces[BLACK][BISHOP] = 0x2400000000000000ULL;
-        pieces[BLACK][ROOK]   = 0x8100000000000000ULL;
-        pieces[BLACK][QUEEN]  = 0x800000000000000ULL;
-        pieces[BLACK][KING]   = 0x1000000000000000ULL;
-
-        update();
+        memset(byType, 0, sizeof(byType));
+        memset(byColor, 0, sizeof(byColor));
+        toggle(WHITE, PAWN,   0xFF00ULL);
+        toggle(WHITE, KNIGHT, 0x42ULL);
+        toggle(WHITE, BISHOP, 0x24ULL);
+        toggle(WHITE, ROOK,   0x81ULL);
+        toggle(WHITE, QUEEN,  0x8ULL);
+        toggle(WHITE, KING,   0x10ULL);
+
+        toggle(BLACK, PAWN,   0xFF000000000000ULL);
+        toggle(BLACK, KNIGHT, 0x4200000000000000ULL);
+        toggle(BLACK, BISHOP, 0x2400000000000000ULL);
+        toggle(BLACK, ROOK,   0x8100000000000000ULL);
+        toggle(BLACK, QUEEN,  0x800000000000000ULL);
+        toggle(BLACK, KING,   0x1000000000000000ULL);
+
+        setSquares();
         side = WHITE;
         ep = -1;
         castle = 15;
+        rule50 = 0;
+        hash = zobristHash(*this);
+        setCheckInfo(*this);
+    }
+
+    // Set up a position from a FEN string
+    void setFen(const std::string& fen) {
+        std::istringstream ss(fen);
+        std::string placement, stm, rights, epSquare;
+        int halfmove = 0;
+        ss >> placement >> stm >> rights >> epSquare >> halfmove;
+
+        memset(byType, 0, sizeof(byType));
+        memset(byColor, 0, sizeof(byColor));
+        const char* symbols = "PNBRQKpnbrqk";
+        int sq = 56;
+        for (char ch : placement) {
+            if (ch == '/') {
+                sq -= 16;
+            } else if (ch >= '1' && ch <= '8') {
+                sq += ch - '0';
+            } else {
+                const char* found = strchr(symbols, ch);
+                if (found && sq >= 0 && sq < 64) {
+                    int code = found - symbols;
+                    toggle(code / 6, code % 6, 1ULL << sq);
+                }
+                sq++;
+            }
+        }
+
+        setSquares();
+        side = (stm == "b") ? BLACK : WHITE;
+        castle = 0;
+        for (char ch : rights) {
+            if (ch == 'K') castle |= 1;
+            else if (ch == 'Q') castle |= 2;
+            else if (ch == 'k') castle |= 4;
+            else if (ch == 'q') castle |= 8;
+        }
+        ep = (epSquare.size() == 2) ? (epSquare[0] - 'a') + (epSquare[1] - '1') * 8 : -1;
+        rule50 = std::min(halfmove, 255);
         hash = zobristHash(*this);
+        setCheckInfo(*this);
+    }
+
+    std::string fen() const {
+        const char* symbols = "PNBRQKpnbrqk";
+        std::string out;
+        for (int rank = 7; rank >= 0; rank--) {
+            int empty = 0;
+            for (int file = 0; file < 8; file++) {
+                int code = squares[rank * 8 + file];
+                if (code == NO_PIECE) {
+                    empty++;
+                    continue;
+                }
+                if (empty) out += (char)('0' + empty);
+                empty = 0;
+                out += symbols[code];
+            }
+            if (empty) out += (char)('0' + empty);
+            if (rank) out += '/';
+        }
+        out += (side == WHITE) ? " w " : " b ";
+        std::string rights;
+        if (castle & 1) rights += 'K';
+        if (castle & 2) rights += 'Q';
+        if (castle & 4) rights += 'k';
+        if (castle & 8) rights += 'q';
+        out += rights.empty() ? "-" : rights;
+        out += ' ';
+        if (ep >= 0) {
+            out += (char)('a' + ep % 8);
+            out += (char)('1' + ep / 8);
+        } else {
+            out += '-';
+        }
+        return out + " " + std::to_string(rule50) + " 1";
     }
 
-    void update() {
-        occupied[WHITE] = occupied[BLACK] = 0;
-        for (int p = PAWN; p <= KING; p++) {
-            occupied[WHITE] |= pieces[WHITE][p];
-            occupied[BLACK] |= pieces[BLACK][p];
+    // Rebuild the mailbox from the bitboards
+    void setSquares() {
+        memset(squares, NO_PIECE, sizeof(squares));
+        for (int c = 0; c < 2; c++) {
+            for (int p = PAWN; p <= KING; p++) {
+                U64 bb = pieces(c, p);
+                while (bb) {
+                    squares[__builtin_ctzll(bb)] = c * 6 + p;
+                    bb &= bb - 1;
+                }
+            }
         }
-        all = occupied[WHITE] | occupied[BLACK];
+    }
+
+    // Piece type on a square, or -1 if empty
+    int pieceOn(int sq) const {
+        return squares[sq] == NO_PIECE ? -1 : squares[sq] % 6;
     }
 
     int evaluate() {
@@ -168,15 +765,15 @@ struct Board {
         // Fast material count
         for (int c = 0; c < 2; c++) {
             for (int p = 0; p < 6; p++) {
-                int count = __builtin_popcountll(pieces[c][p]);
+                int count = __builtin_popcountll(pieces(c, p));
                 eval += (c == WHITE ? count : -count) * values[p];
             }
         }
         
         // King safety (simplified for speed)
         for (int c = 0; c < 2; c++) {
-            if (!pieces[c][KING]) continue;
-            int king_sq = __builtin_ctzll(pieces[c][KING]);
+            if (!pieces(c, KING)) continue;
+            int king_sq = __builtin_ctzll(pieces(c, KING));
             
             // Castling bonus
             if (c == WHITE) {
@@ -188,13 +785,28 @@ struct Board {
             }
         }
         
+        // Slider mobility and pressure on the enemy king's neighbourhood,
+        // from the attack union of each side's sliders
+        U64 rooks[2], bishops[2], attacks[2];
+        for (int c = 0; c < 2; c++) {
+            rooks[c] = pieces(c, ROOK) | pieces(c, QUEEN);
+            bishops[c] = pieces(c, BISHOP) | pieces(c, QUEEN);
+        }
+        sliderAttacks(rooks, bishops, all(), attacks);
+        for (int c = 0; c < 2; c++) {
+            U64 enemyKing = pieces(1 - c, KING);
+            int score = __builtin_popcountll(attacks[c] & ~occupied(c)) * 2;
+            if (enemyKing) score += __builtin_popcountll(attacks[c] & KingMoves[__builtin_ctzll(enemyKing)]) * 8;
+            eval += c == WHITE ? score : -score;
+        }
+        
         // Center control (fast)
         U64 center = 0x0000001818000000ULL;
-        eval += (__builtin_popcountll(pieces[WHITE][PAWN] & center) -
-                 __builtin_popcountll(pieces[BLACK][PAWN] & center)) * 20;
+        eval += (__builtin_popcountll(pieces(WHITE, PAWN) & center) -
+                 __builtin_popcountll(pieces(BLACK, PAWN) & center)) * 20;
         
         // Passed pawns (simplified)
-        U64 wpawns = pieces[WHITE][PAWN];
+        U64 wpawns = pieces(WHITE, PAWN);
         while (wpawns) {
             int sq = __builtin_ctzll(wpawns);
             int rank = sq / 8;
@@ -202,7 +814,7 @@ struct Board {
             wpawns &= wpawns - 1;
         }
         
-        U64 bpawns = pieces[BLACK][PAWN];
+        U64 bpawns = pieces(BLACK, PAWN);
         while (bpawns) {
             int sq = __builtin_ctzll(bpawns);
             int rank = sq / 8;
@@ -214,17 +826,8 @@ struct Board {
     }
 };
 
-struct Move {
-    int from, to, score;
-    int piece, captured, promo;
-
-    Move(int f = 0, int t = 0, int p = 0, int c = -1, int pr = 0)
-        : from(f), to(t), piece(p), captured(c), promo(pr), score(0) {}
-        
-    bool operator==(const Move& other) const {
-        return from == other.from && to == other.to && promo == other.promo;
-    }
-};
+// Copy-make copies whole lines: bitboards, state, mailbox
+static_assert(sizeof(Board) == 3 * 64, "Board layout should span three cache lines");
 
 // Zobrist hashing for transposition table
 U64 zobristPieces[2][6][64];
@@ -257,7 +860,7 @@ U64 zobristHash(const Board& b) {
     
     for (int c = 0; c < 2; c++) {
         for (int p = 0; p < 6; p++) {
-            U64 bb = b.pieces[c][p];
+            U64 bb = b.pieces(c, p);
             while (bb) {
                 int sq = __builtin_ctzll(bb);
                 hash ^= zobristPieces[c][p][sq];
@@ -324,27 +927,212 @@ U64 get_bishop_attacks(int sq, U64 blockers) {
     return attacks;
 }
 
+// Set-wise slider attacks: Kogge-Stone occluded fills expand every slider
+// of a side in a direction at once, in three shift steps. Evaluation only
+// needs the union per side, so this replaces per-piece ray walks there.
+const U64 NOT_A_FILE = 0xFEFEFEFEFEFEFEFEULL;
+const U64 NOT_H_FILE = 0x7F7F7F7F7F7F7F7FULL;
+
+#if defined(__AVX2__)
+// The four upward directions share one 256-bit register (N, E, NE, NW),
+// the four downward ones another (S, W, SW, SE), with per-lane shifts
+inline __m256i fillUp(__m256i gen, __m256i pro, __m256i shift, __m256i wrap) {
+    pro = _mm256_and_si256(pro, wrap);
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_sllv_epi64(gen, shift)));
+    pro = _mm256_and_si256(pro, _mm256_sllv_epi64(pro, shift));
+    shift = _mm256_add_epi64(shift, shift);
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_sllv_epi64(gen, shift)));
+    pro = _mm256_and_si256(pro, _mm256_sllv_epi64(pro, shift));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_sllv_epi64(gen, _mm256_add_epi64(shift, shift))));
+    return gen;
+}
+
+inline __m256i fillDown(__m256i gen, __m256i pro, __m256i shift, __m256i wrap) {
+    pro = _mm256_and_si256(pro, wrap);
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srlv_epi64(gen, shift)));
+    pro = _mm256_and_si256(pro, _mm256_srlv_epi64(pro, shift));
+    shift = _mm256_add_epi64(shift, shift);
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srlv_epi64(gen, shift)));
+    pro = _mm256_and_si256(pro, _mm256_srlv_epi64(pro, shift));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srlv_epi64(gen, _mm256_add_epi64(shift, shift))));
+    return gen;
+}
+
+inline U64 orLanes(__m256i v) {
+    __m128i x = _mm_or_si128(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    return (U64)_mm_cvtsi128_si64(_mm_or_si128(x, _mm_unpackhi_epi64(x, x)));
+}
+
+void sliderAttacks(const U64 rooks[2], const U64 bishops[2], U64 occupied, U64 attacks[2]) {
+    const __m256i shift = _mm256_set_epi64x(7, 9, 1, 8);
+    const __m256i wrapUp = _mm256_set_epi64x(NOT_H_FILE, NOT_A_FILE, NOT_A_FILE, ~0ULL);
+    const __m256i wrapDown = _mm256_set_epi64x(NOT_A_FILE, NOT_H_FILE, NOT_H_FILE, ~0ULL);
+    const __m256i empty = _mm256_set1_epi64x(~occupied);
+    for (int c = 0; c < 2; c++) {
+        __m256i gen = _mm256_set_epi64x(bishops[c], bishops[c], rooks[c], rooks[c]);
+        __m256i up = _mm256_and_si256(_mm256_sllv_epi64(fillUp(gen, empty, shift, wrapUp), shift), wrapUp);
+        __m256i down = _mm256_and_si256(_mm256_srlv_epi64(fillDown(gen, empty, shift, wrapDown), shift), wrapDown);
+        attacks[c] = orLanes(_mm256_or_si256(up, down));
+    }
+}
+#elif defined(__SSE2__)
+// Both sides share one 128-bit register and go through the eight
+// directions together (SSE2 shifts every lane by the same count)
+inline __m128i fill(__m128i gen, __m128i pro, int s, U64 wrap, bool up) {
+    __m128i count = _mm_cvtsi32_si128(s), count2 = _mm_cvtsi32_si128(2 * s), count4 = _mm_cvtsi32_si128(4 * s);
+    __m128i w = _mm_set1_epi64x(wrap);
+    pro = _mm_and_si128(pro, w);
+    if (up) {
+        gen = _mm_or_si128(gen, _mm_and_si128(pro, _mm_sll_epi64(gen, count)));
+        pro = _mm_and_si128(pro, _mm_sll_epi64(pro, count));
+        gen = _mm_or_si128(gen, _mm_and_si128(pro, _mm_sll_epi64(gen, count2)));
+        pro = _mm_and_si128(pro, _mm_sll_epi64(pro, count2));
+        gen = _mm_or_si128(gen, _mm_and_si128(pro, _mm_sll_epi64(gen, count4)));
+        return _mm_and_si128(_mm_sll_epi64(gen, count), w);
+    }
+    gen = _mm_or_si128(gen, _mm_and_si128(pro, _mm_srl_epi64(gen, count)));
+    pro = _mm_and_si128(pro, _mm_srl_epi64(pro, count));
+    gen = _mm_or_si128(gen, _mm_and_si128(pro, _mm_srl_epi64(gen, count2)));
+    pro = _mm_and_si128(pro, _mm_srl_epi64(pro, count2));
+    gen = _mm_or_si128(gen, _mm_and_si128(pro, _mm_srl_epi64(gen, count4)));
+    return _mm_and_si128(_mm_srl_epi64(gen, count), w);
+}
+
+void sliderAttacks(const U64 rooks[2], const U64 bishops[2], U64 occupied, U64 attacks[2]) {
+    __m128i r = _mm_set_epi64x(rooks[1], rooks[0]);
+    __m128i b = _mm_set_epi64x(bishops[1], bishops[0]);
+    __m128i empty = _mm_set1_epi64x(~occupied);
+    __m128i a = _mm_or_si128(_mm_or_si128(fill(r, empty, 8, ~0ULL, true), fill(r, empty, 8, ~0ULL, false)),
+                             _mm_or_si128(fill(r, empty, 1, NOT_A_FILE, true), fill(r, empty, 1, NOT_H_FILE, false)));
+    a = _mm_or_si128(a, _mm_or_si128(fill(b, empty, 9, NOT_A_FILE, true), fill(b, empty, 7, NOT_H_FILE, true)));
+    a = _mm_or_si128(a, _mm_or_si128(fill(b, empty, 9, NOT_H_FILE, false), fill(b, empty, 7, NOT_A_FILE, false)));
+    _mm_storeu_si128((__m128i*)attacks, a);
+}
+#else
+U64 fill(U64 gen, U64 pro, int s, U64 wrap, bool up) {
+    pro &= wrap;
+    for (int step = s; step <= 4 * s; step *= 2) {
+        gen |= pro & (up ? gen << step : gen >> step);
+        pro &= up ? pro << step : pro >> step;
+    }
+    return (up ? gen << s : gen >> s) & wrap;
+}
+
+void sliderAttacks(const U64 rooks[2], const U64 bishops[2], U64 occupied, U64 attacks[2]) {
+    for (int c = 0; c < 2; c++) {
+        U64 r = rooks[c], b = bishops[c];
+        attacks[c] = fill(r, ~occupied, 8, ~0ULL, true) | fill(r, ~occupied, 8, ~0ULL, false) |
+                     fill(r, ~occupied, 1, NOT_A_FILE, true) | fill(r, ~occupied, 1, NOT_H_FILE, false) |
+                     fill(b, ~occupied, 9, NOT_A_FILE, true) | fill(b, ~occupied, 7, NOT_H_FILE, true) |
+                     fill(b, ~occupied, 9, NOT_H_FILE, false) | fill(b, ~occupied, 7, NOT_A_FILE, false);
+    }
+}
+#endif
+
 bool is_attacked(int sq, int attacker, const Board& b) {
     if (attacker == WHITE) {
-        if ((sq >= 9) && (sq % 8 != 0) && ((1ULL << (sq - 9)) & b.pieces[WHITE][PAWN])) return true;
-        if ((sq >= 7) && (sq % 8 != 7) && ((1ULL << (sq - 7)) & b.pieces[WHITE][PAWN])) return true;
+        if ((sq >= 9) && (sq % 8 != 0) && ((1ULL << (sq - 9)) & b.pieces(WHITE, PAWN))) return true;
+        if ((sq >= 7) && (sq % 8 != 7) && ((1ULL << (sq - 7)) & b.pieces(WHITE, PAWN))) return true;
     } else {
-        if ((sq <= 56) && (sq % 8 != 0) && ((1ULL << (sq + 7)) & b.pieces[BLACK][PAWN])) return true;
-        if ((sq <= 54) && (sq % 8 != 7) && ((1ULL << (sq + 9)) & b.pieces[BLACK][PAWN])) return true;
+        if ((sq <= 56) && (sq % 8 != 0) && ((1ULL << (sq + 7)) & b.pieces(BLACK, PAWN))) return true;
+        if ((sq <= 54) && (sq % 8 != 7) && ((1ULL << (sq + 9)) & b.pieces(BLACK, PAWN))) return true;
     }
 
-    if (KnightMoves[sq] & b.pieces[attacker][KNIGHT]) return true;
-    if (KingMoves[sq] & b.pieces[attacker][KING]) return true;
-    if (get_rook_attacks(sq, b.all) & (b.pieces[attacker][ROOK] | b.pieces[attacker][QUEEN])) return true;
-    if (get_bishop_attacks(sq, b.all) & (b.pieces[attacker][BISHOP] | b.pieces[attacker][QUEEN])) return true;
+    if (KnightMoves[sq] & b.pieces(attacker, KNIGHT)) return true;
+    if (KingMoves[sq] & b.pieces(attacker, KING)) return true;
+    if (get_rook_attacks(sq, b.all()) & (b.pieces(attacker, ROOK) | b.pieces(attacker, QUEEN))) return true;
+    if (get_bishop_attacks(sq, b.all()) & (b.pieces(attacker, BISHOP) | b.pieces(attacker, QUEEN))) return true;
 
     return false;
 }
 
+// All pieces of one side attacking a square, sliders seen through occ
+U64 attackersTo(int sq, int attacker, const Board& b, U64 occ) {
+    return (PawnAttacks[1 - attacker][sq] & b.pieces(attacker, PAWN)) |
+           (KnightMoves[sq] & b.pieces(attacker, KNIGHT)) |
+           (KingMoves[sq] & b.pieces(attacker, KING)) |
+           (get_rook_attacks(sq, occ) & (b.pieces(attacker, ROOK) | b.pieces(attacker, QUEEN))) |
+           (get_bishop_attacks(sq, occ) & (b.pieces(attacker, BISHOP) | b.pieces(attacker, QUEEN)));
+}
+
+// Compute checkers, pins and check squares for the side to move
+void setCheckInfo(Board& b) {
+    int us = b.side, them = 1 - b.side;
+    b.checkers = 0;
+    b.pinned = 0;
+    if (b.pieces(us, KING)) {
+        int own_king = __builtin_ctzll(b.pieces(us, KING));
+        b.checkers = attackersTo(own_king, them, b, b.all());
+
+        // Enemy sliders lined up with our king through exactly one of our pieces
+        U64 snipers = (RookRays[own_king] & (b.pieces(them, ROOK) | b.pieces(them, QUEEN))) |
+                      (BishopRays[own_king] & (b.pieces(them, BISHOP) | b.pieces(them, QUEEN)));
+        while (snipers) {
+            U64 blockers = Between[own_king][__builtin_ctzll(snipers)] & b.all();
+            if (blockers && !(blockers & (blockers - 1)) && (blockers & b.occupied(us)))
+                b.pinned |= blockers;
+            snipers &= snipers - 1;
+        }
+    }
+
+    if (b.pieces(them, KING) == 0) {
+        memset(b.checkSq, 0, sizeof(b.checkSq));
+        return;
+    }
+    int king_sq = __builtin_ctzll(b.pieces(them, KING));
+    b.checkSq[PAWN]   = PawnAttacks[them][king_sq];
+    b.checkSq[KNIGHT] = KnightMoves[king_sq];
+    b.checkSq[BISHOP] = get_bishop_attacks(king_sq, b.all());
+    b.checkSq[ROOK]   = get_rook_attacks(king_sq, b.all());
+}
+
 bool isInCheck(const Board& b) {
-    if (b.pieces[b.side][KING] == 0) return false;
-    int king_sq = __builtin_ctzll(b.pieces[b.side][KING]);
-    return is_attacked(king_sq, 1 - b.side, b);
+    return b.checkers != 0;
+}
+
+// Does the move check the enemy king? Decided before making it.
+bool givesCheck(const Board& b, const Move& m) {
+    int us = b.side, them = 1 - b.side;
+    if (b.pieces(them, KING) == 0) return false;
+    int king_sq = __builtin_ctzll(b.pieces(them, KING));
+    U64 king_bb = 1ULL << king_sq;
+    U64 from_bb = 1ULL << m.from;
+    U64 to_bb = 1ULL << m.to;
+    U64 occ = (b.all() ^ from_bb) | to_bb;
+
+    // Direct check
+    if (m.promo) {
+        U64 attacks = 0;
+        if (m.promo == KNIGHT) attacks = KnightMoves[m.to];
+        if (m.promo == BISHOP || m.promo == QUEEN) attacks |= get_bishop_attacks(m.to, occ);
+        if (m.promo == ROOK || m.promo == QUEEN) attacks |= get_rook_attacks(m.to, occ);
+        if (attacks & king_bb) return true;
+    } else if (b.checkSquares(m.piece) & to_bb) {
+        return true;
+    }
+
+    // Castling checks only through the rook
+    if (m.piece == KING && std::abs(m.from - m.to) == 2) {
+        int rook_from = m.to > m.from ? m.from + 3 : m.from - 4;
+        int rook_to = m.to > m.from ? m.from + 1 : m.from - 1;
+        occ ^= (1ULL << rook_from) | (1ULL << rook_to);
+        return (get_rook_attacks(rook_to, occ) & king_bb) != 0;
+    }
+
+    // Discovered check through the vacated square (and the en passant victim)
+    U64 vacated = from_bb;
+    if (m.piece == PAWN && m.to == b.ep) {
+        U64 victim = 1ULL << (us == WHITE ? m.to - 8 : m.to + 8);
+        occ ^= victim;
+        vacated |= victim;
+    }
+    if ((RookRays[king_sq] & vacated) &&
+        (get_rook_attacks(king_sq, occ) & (b.pieces(us, ROOK) | b.pieces(us, QUEEN)) & ~from_bb))
+        return true;
+    if ((BishopRays[king_sq] & vacated) &&
+        (get_bishop_attacks(king_sq, occ) & (b.pieces(us, BISHOP) | b.pieces(us, QUEEN)) & ~from_bb))
+        return true;
+    return false;
 }
 
 void makeMove(Board& b, const Move& m) {
@@ -375,78 +1163,194 @@ void makeMove(Board& b, const Move& m) {
     b.ep = -1;
 
     // Move piece
-    b.pieces[b.side][m.piece] ^= (from_bb | to_bb);
+    b.toggle(b.side, m.piece, from_bb | to_bb);
 
-    // Handle captures
-    for (int p = PAWN; p <= KING; ++p) {
-        if (b.pieces[opponent][p] & to_bb) {
-            b.pieces[opponent][p] ^= to_bb;
-            b.hash ^= zobristPieces[opponent][p][m.to];
-            break;
-        }
+    // Handle captures (mailbox lookup)
+    int captured = b.squares[m.to];
+    if (captured != NO_PIECE) {
+        b.toggle(opponent, captured % 6, to_bb);
+        b.hash ^= zobristPieces[opponent][captured % 6][m.to];
     }
+    b.squares[m.from] = NO_PIECE;
+    b.squares[m.to] = b.side * 6 + m.piece;
+
+    // Fifty-move counter
+    if (m.piece == PAWN || captured != NO_PIECE) b.rule50 = 0;
+    else if (b.rule50 < 255) b.rule50++;
 
     // Handle special moves
     if (m.piece == PAWN) {
         if (m.to == prev_ep) {
             int captured_pawn_sq = (b.side == WHITE) ? m.to - 8 : m.to + 8;
-            b.pieces[opponent][PAWN] ^= (1ULL << captured_pawn_sq);
+            b.toggle(opponent, PAWN, 1ULL << captured_pawn_sq);
             b.hash ^= zobristPieces[opponent][PAWN][captured_pawn_sq];
+            b.squares[captured_pawn_sq] = NO_PIECE;
         }
         if (std::abs(m.from - m.to) == 16) {
             b.ep = (b.side == WHITE) ? m.from + 8 : m.from - 8;
             b.hash ^= zobristEp[b.ep];
         }
         if (m.promo) {
-            b.pieces[b.side][PAWN] ^= to_bb;
-            b.pieces[b.side][m.promo] ^= to_bb;
+            b.toggle(b.side, PAWN, to_bb);
+            b.toggle(b.side, m.promo, to_bb);
             b.hash ^= zobristPieces[b.side][PAWN][m.to];
             b.hash ^= zobristPieces[b.side][m.promo][m.to];
+            b.squares[m.to] = b.side * 6 + m.promo;
         }
     } else if (m.piece == KING) {
         if (std::abs(m.from - m.to) == 2) {
-            if (m.to == 6) {
-                b.pieces[WHITE][ROOK] ^= (1ULL << 7 | 1ULL << 5);
-                b.hash ^= zobristPieces[WHITE][ROOK][7];
-                b.hash ^= zobristPieces[WHITE][ROOK][5];
-            } else if (m.to == 2) {
-                b.pieces[WHITE][ROOK] ^= (1ULL << 0 | 1ULL << 3);
-                b.hash ^= zobristPieces[WHITE][ROOK][0];
-                b.hash ^= zobristPieces[WHITE][ROOK][3];
-            } else if (m.to == 62) {
-                b.pieces[BLACK][ROOK] ^= (1ULL << 63 | 1ULL << 61);
-                b.hash ^= zobristPieces[BLACK][ROOK][63];
-                b.hash ^= zobristPieces[BLACK][ROOK][61];
-            } else if (m.to == 58) {
-                b.pieces[BLACK][ROOK] ^= (1ULL << 56 | 1ULL << 59);
-                b.hash ^= zobristPieces[BLACK][ROOK][56];
-                b.hash ^= zobristPieces[BLACK][ROOK][59];
-            }
-        }
-    }
-
-    b.update();
+            int rook_from = -1, rook_to = -1;
+            if (m.to == 6) { rook_from = 7; rook_to = 5; }
+            else if (m.to == 2) { rook_from = 0; rook_to = 3; }
+            else if (m.to == 62) { rook_from = 63; rook_to = 61; }
+            else if (m.to == 58) { rook_from = 56; rook_to = 59; }
+            if (rook_from != -1) {
+                b.toggle(b.side, ROOK, 1ULL << rook_from | 1ULL << rook_to);
+                b.hash ^= zobristPieces[b.side][ROOK][rook_from];
+                b.hash ^= zobristPieces[b.side][ROOK][rook_to];
+                b.squares[rook_from] = NO_PIECE;
+                b.squares[rook_to] = b.side * 6 + ROOK;
+            }
+        }
+    }
+
     b.side = opponent;
     b.hash ^= zobristSide;
+    setCheckInfo(b);
 }
 
-bool isLegalMove(Board& b, const Move& m) {
-    Board copy = b;
-    makeMove(copy, m);
-    if (copy.pieces[b.side][KING] == 0) return false;
-    int king_sq = __builtin_ctzll(copy.pieces[b.side][KING]);
-    return !is_attacked(king_sq, copy.side, copy);
+// Legality of a pseudo-legal move without making it
+bool isLegal(const Board& b, const Move& m) {
+    int us = b.side, them = 1 - b.side;
+    if (b.pieces(us, KING) == 0) return true;
+    int king_sq = __builtin_ctzll(b.pieces(us, KING));
+    U64 from_bb = 1ULL << m.from;
+    U64 to_bb = 1ULL << m.to;
+
+    // The king may not step onto an attacked square, nor hide behind itself
+    if (m.piece == KING)
+        return !attackersTo(m.to, them, b, b.all() ^ from_bb);
+
+    // En passant removes two pieces from one line: test the sliders directly
+    if (m.piece == PAWN && m.to == b.ep) {
+        U64 victim = 1ULL << (us == WHITE ? m.to - 8 : m.to + 8);
+        U64 occ = (b.all() ^ from_bb ^ victim) | to_bb;
+        if (b.checkers & ~victim & ~(b.pieces(them, ROOK) | b.pieces(them, BISHOP) | b.pieces(them, QUEEN)))
+            return false;
+        return !(get_rook_attacks(king_sq, occ) & (b.pieces(them, ROOK) | b.pieces(them, QUEEN))) &&
+               !(get_bishop_attacks(king_sq, occ) & (b.pieces(them, BISHOP) | b.pieces(them, QUEEN)));
+    }
+
+    // In check: capture the single checker or block its line
+    if (b.checkers) {
+        if (b.checkers & (b.checkers - 1)) return false;
+        if (!((Between[king_sq][__builtin_ctzll(b.checkers)] | b.checkers) & to_bb)) return false;
+    }
+
+    // Pinned pieces may only move along the pin line
+    return !(b.pinned & from_bb) || (Line[m.from][king_sq] & to_bb);
+}
+
+// Castling rights, empty path and no attacked square on the king's way
+bool canCastle(const Board& b, bool kingSide) {
+    if (isInCheck(b)) return false;
+    int right = (b.side == WHITE ? 1 : 4) << (kingSide ? 0 : 1);
+    if (!(b.castle & right)) return false;
+    int king_sq = (b.side == WHITE) ? 4 : 60;
+    U64 path = kingSide ? 0x60ULL : 0xEULL;
+    if (b.all() & (path << (king_sq - 4))) return false;
+    int step = kingSide ? 1 : -1;
+    return !is_attacked(king_sq + step, 1 - b.side, b) &&
+           !is_attacked(king_sq + 2 * step, 1 - b.side, b);
+}
+
+// Can a move from the TT or killer table be played here? Checks
+// everything generateMoves would, except leaving the king in check.
+bool isPseudoLegal(const Board& b, const Move& m) {
+    int us = b.side;
+    if (m.from == m.to || m.piece < PAWN || m.piece > KING) return false;
+    U64 from_bb = 1ULL << m.from;
+    U64 to_bb = 1ULL << m.to;
+    if (!(b.pieces(us, m.piece) & from_bb) || (b.occupied(us) & to_bb)) return false;
+
+    if (m.piece == PAWN) {
+        int dir = (us == WHITE) ? 8 : -8;
+        int promo_rank = (us == WHITE) ? 7 : 0;
+        if (m.promo != ((m.to / 8) == promo_rank ? QUEEN : 0)) return false;
+        if (PawnAttacks[us][m.from] & to_bb)
+            return (b.occupied(1 - us) & to_bb) || m.to == b.ep;
+        if (b.all() & to_bb) return false;
+        if (m.to == m.from + dir) return true;
+        int start_rank = (us == WHITE) ? 1 : 6;
+        return m.to == m.from + 2 * dir && (m.from / 8) == start_rank &&
+               !(b.all() & (1ULL << (m.from + dir)));
+    }
+    if (m.promo) return false;
+
+    switch (m.piece) {
+        case KNIGHT: return (KnightMoves[m.from] & to_bb) != 0;
+        case BISHOP: return (get_bishop_attacks(m.from, b.all()) & to_bb) != 0;
+        case ROOK:   return (get_rook_attacks(m.from, b.all()) & to_bb) != 0;
+        case QUEEN:  return ((get_rook_attacks(m.from, b.all()) | get_bishop_attacks(m.from, b.all())) & to_bb) != 0;
+    }
+    if (KingMoves[m.from] & to_bb) return true;
+    int king_from = (us == WHITE) ? 4 : 60;
+    if (m.from != king_from) return false;
+    if (m.to == king_from + 2) return canCastle(b, true);
+    if (m.to == king_from - 2) return canCastle(b, false);
+    return false;
+}
+
+// Move generation modes
+enum { GEN_ALL, GEN_CAPTURES, GEN_QUIET_CHECKS };
+
+// Append a move from 'from' to every target square. On AVX-512 VBMI2
+// hosts the targets are compressed into a packed square list (VPCOMPRESSB)
+// and their mailbox codes gathered with one byte permute; elsewhere the
+// bits are popped one at a time.
+#if defined(__AVX512VBMI2__) && defined(__AVX512VBMI__)
+alignas(64) const uint8_t SquareIndex[64] = {
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+    16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+    32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+    48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63
+};
+const int8_t CodePiece[NO_PIECE + 1] = {0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, -1};
+
+inline void addMoves(std::vector<Move>& moves, const Board& b, int from, int piece, U64 targets) {
+    int n = __builtin_popcountll(targets);
+    if (!n) return;
+    alignas(64) uint8_t to[64], code[64];
+    __m512i packed = _mm512_maskz_compress_epi8(targets, _mm512_load_si512(SquareIndex));
+    _mm512_store_si512(to, packed);
+    _mm512_store_si512(code, _mm512_maskz_permutexvar_epi8(~0ULL, packed, _mm512_loadu_si512(b.squares)));
+    size_t base = moves.size();
+    moves.resize(base + n);
+    Move* out = &moves[base];
+    for (int i = 0; i < n; i++) {
+        out[i] = Move(from, to[i], piece, CodePiece[code[i]]);
+    }
+}
+#else
+inline void addMoves(std::vector<Move>& moves, const Board& b, int from, int piece, U64 targets) {
+    while (targets) {
+        int to = __builtin_ctzll(targets);
+        moves.push_back(Move(from, to, piece, b.pieceOn(to)));
+        targets &= targets - 1;
+    }
 }
+#endif
 
 // Move generation optimized for ordering
-std::vector<Move> generateMoves(Board& b, bool capturesOnly = false) {
+std::vector<Move> generateMoves(Board& b, int mode = GEN_ALL) {
+    bool capturesOnly = mode == GEN_CAPTURES;
     std::vector<Move> moves;
     moves.reserve(capturesOnly ? 32 : 128);
     U64 bitboard, attacks;
     int from, to;
 
     for (int p = PAWN; p <= KING; p++) {
-        bitboard = b.pieces[b.side][p];
+        bitboard = b.pieces(b.side, p);
         while (bitboard) {
             from = __builtin_ctzll(bitboard);
             attacks = 0;
@@ -458,7 +1362,7 @@ std::vector<Move> generateMoves(Board& b, bool capturesOnly = false) {
                 if (!capturesOnly) {
                     // Single push
                     int to_sq = from + dir;
-                    if (to_sq >= 0 && to_sq < 64 && !(b.all & (1ULL << to_sq))) {
+                    if (to_sq >= 0 && to_sq < 64 && !(b.all() & (1ULL << to_sq))) {
                         if ((to_sq / 8) == promo_rank) {
                             moves.push_back(Move(from, to_sq, p, -1, QUEEN));
                         } else {
@@ -467,7 +1371,7 @@ std::vector<Move> generateMoves(Board& b, bool capturesOnly = false) {
                             int start_rank = (b.side == WHITE) ? 1 : 6;
                             if ((from / 8) == start_rank) {
                                 int to_sq2 = from + 2 * dir;
-                                if (!(b.all & (1ULL << to_sq2))) {
+                                if (!(b.all() & (1ULL << to_sq2))) {
                                     moves.push_back(Move(from, to_sq2, p));
                                 }
                             }
@@ -481,63 +1385,37 @@ std::vector<Move> generateMoves(Board& b, bool capturesOnly = false) {
                     to = from + d;
                     if (to < 0 || to > 63 || std::abs((from % 8) - (to % 8)) > 1) continue;
 
-                    if (b.occupied[1 - b.side] & (1ULL << to)) {
+                    if (b.occupied(1 - b.side) & (1ULL << to)) {
                         if ((to / 8) == promo_rank) {
-                            moves.push_back(Move(from, to, p, 0, QUEEN));
+                            moves.push_back(Move(from, to, p, b.pieceOn(to), QUEEN));
                         } else {
-                            moves.push_back(Move(from, to, p));
+                            moves.push_back(Move(from, to, p, b.pieceOn(to)));
                         }
                     } else if (!capturesOnly && to == b.ep) {
-                        moves.push_back(Move(from, to, p));
+                        moves.push_back(Move(from, to, p, PAWN));
                     }
                 }
             } else if (p == KING && !capturesOnly) {
-                attacks = KingMoves[from] & ~b.occupied[b.side];
+                attacks = KingMoves[from] & ~b.occupied(b.side);
                 // Castling
-                if (!isInCheck(b)) {
-                    if (b.side == WHITE) {
-                        if ((b.castle & 1) && !(b.all & 0x60ULL)) {
-                            if (!is_attacked(5, BLACK, b) && !is_attacked(6, BLACK, b)) {
-                                moves.push_back(Move(4, 6, KING));
-                            }
-                        }
-                        if ((b.castle & 2) && !(b.all & 0xEULL)) {
-                            if (!is_attacked(3, BLACK, b) && !is_attacked(2, BLACK, b)) {
-                                moves.push_back(Move(4, 2, KING));
-                            }
-                        }
-                    } else {
-                        if ((b.castle & 4) && !(b.all & 0x6000000000000000ULL)) {
-                            if (!is_attacked(61, WHITE, b) && !is_attacked(62, WHITE, b)) {
-                                moves.push_back(Move(60, 62, KING));
-                            }
-                        }
-                        if ((b.castle & 8) && !(b.all & 0xE00000000000000ULL)) {
-                            if (!is_attacked(59, WHITE, b) && !is_attacked(58, WHITE, b)) {
-                                moves.push_back(Move(60, 58, KING));
-                            }
-                        }
-                    }
-                }
+                int king_from = (b.side == WHITE) ? 4 : 60;
+                if (canCastle(b, true)) moves.push_back(Move(king_from, king_from + 2, KING));
+                if (canCastle(b, false)) moves.push_back(Move(king_from, king_from - 2, KING));
             } else {
                 if (p == KNIGHT) attacks = KnightMoves[from];
-                else if (p == BISHOP) attacks = get_bishop_attacks(from, b.all);
-                else if (p == ROOK) attacks = get_rook_attacks(from, b.all);
-                else if (p == QUEEN) attacks = (get_rook_attacks(from, b.all) | get_bishop_attacks(from, b.all));
+                else if (p == BISHOP) attacks = get_bishop_attacks(from, b.all());
+                else if (p == ROOK) attacks = get_rook_attacks(from, b.all());
+                else if (p == QUEEN) attacks = (get_rook_attacks(from, b.all()) | get_bishop_attacks(from, b.all()));
                 else if (p == KING) attacks = KingMoves[from];
                 
                 if (capturesOnly) {
-                    attacks &= b.occupied[1 - b.side];
+                    attacks &= b.occupied(1 - b.side);
                 } else {
-                    attacks &= ~b.occupied[b.side];
+                    attacks &= ~b.occupied(b.side);
                 }
             }
 
-            while (attacks) {
-                to = __builtin_ctzll(attacks);
-                moves.push_back(Move(from, to, p));
-                attacks &= attacks - 1;
-            }
+            addMoves(moves, b, from, p, attacks);
 
             bitboard &= bitboard - 1;
         }
@@ -548,7 +1426,8 @@ std::vector<Move> generateMoves(Board& b, bool capturesOnly = false) {
     legalMoves.reserve(moves.size());
     
     for (auto& m : moves) {
-        if (isLegalMove(b, m)) {
+        if (mode == GEN_QUIET_CHECKS && (m.captured != -1 || m.promo || !givesCheck(b, m))) continue;
+        if (isLegal(b, m)) {
             legalMoves.push_back(m);
         }
     }
@@ -566,17 +1445,12 @@ void scoreMoves(std::vector<Move>& moves, Board& b, Move* ttMove, int ply) {
         }
         
         // MVV-LVA for captures
-        if (b.occupied[1 - b.side] & (1ULL << m.to)) {
+        if (m.captured != -1) {
             int victimValues[] = {100, 300, 300, 500, 900, 10000};
-            for (int p = KING; p >= PAWN; p--) {
-                if (b.pieces[1 - b.side][p] & (1ULL << m.to)) {
-                    m.score = 100000 + victimValues[p] * 10 - victimValues[m.piece];
-                    break;
-                }
-            }
+            m.score = 100000 + victimValues[m.captured] * 10 - victimValues[m.piece];
         }
         // Killer moves
-        else if (killerMoves.isKiller(&m, ply)) {
+        else if (killerMoves.isKiller(m, ply)) {
             m.score = 90000;
         }
         // History heuristic
@@ -592,29 +1466,173 @@ void scoreMoves(std::vector<Move>& moves, Board& b, Move* ttMove, int ply) {
               [](const Move& a, const Move& b) { return a.score > b.score; });
 }
 
+// Root moves this process may search; empty means all of them
+std::vector<Move> rootMoves;
+
+bool rootAllowed(const Move& m) {
+    return rootMoves.empty() || std::find(rootMoves.begin(), rootMoves.end(), m) != rootMoves.end();
+}
+
+// Staged move supply for search: the TT move and killers are validated
+// and tried before generation, which is skipped when one of them cuts off
+struct MovePicker {
+    enum { STAGE_TT, STAGE_KILLERS, STAGE_GENERATE, STAGE_REST, STAGE_DONE };
+    
+    Board& b;
+    int ply, stage, killerIndex, triedCount;
+    size_t index;
+    Move ttMove;
+    Move killers[2];
+    Move tried[3];
+    std::vector<Move> moves;
+    
+    MovePicker(Board& board, const Move& tt, int p)
+        : b(board), ply(p), stage(STAGE_TT), killerIndex(0), triedCount(0), index(0), ttMove(tt) {
+        // Copied now: other threads may continue this picker at a split point
+        killers[0] = killerMoves.killers[ply][0];
+        killers[1] = killerMoves.killers[ply][1];
+    }
+    
+    bool next(Move& m) {
+        while (nextStaged(m)) {
+            if (ply != 0 || rootAllowed(m)) return true;
+        }
+        return false;
+    }
+    
+    bool nextStaged(Move& m) {
+        switch (stage) {
+            case STAGE_TT:
+                stage = STAGE_KILLERS;
+                if (accept(ttMove, false)) {
+                    m = ttMove;
+                    return true;
+                }
+                // fall through
+            case STAGE_KILLERS:
+                while (killerIndex < 2) {
+                    Move killer = killers[killerIndex++];
+                    if (accept(killer, true)) {
+                        m = killer;
+                        return true;
+                    }
+                }
+                stage = STAGE_GENERATE;
+                // fall through
+            case STAGE_GENERATE:
+                moves = generateMoves(b);
+                scoreMoves(moves, b, nullptr, ply);
+                stage = STAGE_REST;
+                // fall through
+            case STAGE_REST:
+                while (index < moves.size()) {
+                    const Move& g = moves[index++];
+                    if (!wasTried(g)) {
+                        m = g;
+                        return true;
+                    }
+                }
+                stage = STAGE_DONE;
+        }
+        return false;
+    }
+    
+    bool wasTried(const Move& m) const {
+        for (int i = 0; i < triedCount; i++)
+            if (tried[i] == m) return true;
+        return false;
+    }
+    
+    // Validate a stored move before searching it ahead of generation
+    bool accept(Move& m, bool quietOnly) {
+        if (!isPseudoLegal(b, m) || wasTried(m)) return false;
+        m.captured = (m.piece == PAWN && m.to == b.ep) ? PAWN : b.pieceOn(m.to);
+        if (quietOnly && m.captured != -1) return false;
+        if (!isLegal(b, m)) return false;
+        tried[triedCount++] = m;
+        return true;
+    }
+};
+
+// Pawn-structure key mixed from the two pawn bitboards (top bits are best)
+U64 pawnKey(const Board& b) {
+    return (b.pieces(WHITE, PAWN) * 0x9E3779B97F4A7C15ULL) ^
+           ((b.pieces(BLACK, PAWN) >> 8 | b.pieces(BLACK, PAWN) << 56) * 0xC2B2AE3D27D4EB4FULL);
+}
+
+// Correction history: the running difference between search results and
+// static eval in each pawn structure, learned as the search goes and
+// added to evaluate() wherever static eval drives a pruning decision
+const int CORRECTION_BITS = 14;
+const int CORRECTION_GRAIN = 256; // Entries are in 1/256 centipawn
+const int CORRECTION_LIMIT = 128 * CORRECTION_GRAIN;
+
+struct CorrectionHistory {
+    int table[2][1 << CORRECTION_BITS]; // [side][pawn key]
+    
+    void init() {
+        memset(table, 0, sizeof(table));
+    }
+    
+    int& entry(const Board& b) {
+        return table[b.side][pawnKey(b) >> (64 - CORRECTION_BITS)];
+    }
+    
+    int correct(const Board& b, int eval) {
+        return eval + entry(b) / CORRECTION_GRAIN;
+    }
+    
+    // Deeper results move the average further
+    void update(const Board& b, int diff, int depth) {
+        int& e = entry(b);
+        int weight = std::min(depth + 1, 16);
+        e = (e * (256 - weight) + diff * CORRECTION_GRAIN * weight) / 256;
+        e = std::max(-CORRECTION_LIMIT, std::min(CORRECTION_LIMIT, e));
+    }
+};
+thread_local CorrectionHistory correctionHistory; // One per search thread
+
+// Static eval and its corrected value, computed on first use (-INF: not yet)
+void lazyEval(Board& b, int& rawEval, int& staticEval) {
+    if (rawEval != -INF) return;
+    rawEval = b.evaluate();
+    staticEval = correctionHistory.correct(b, rawEval);
+}
+
 // Quiescence search
-int quiescence(Board& b, int alpha, int beta, int depth) {
-    searchStats.qnodes++;
+int quiescence(Board& b, int alpha, int beta, int depth, int ply) {
+    localStats->qnodes.inc();
+    localStats->seldepth.max(ply);
     
-    int stand_pat = b.evaluate();
+    bool inCheck = isInCheck(b);
+    int stand_pat = correctionHistory.correct(b, b.evaluate());
     
-    if (stand_pat >= beta) return beta;
-    if (alpha < stand_pat) alpha = stand_pat;
+    // No standing pat while in check: all evasions are searched
+    if (!inCheck) {
+        if (stand_pat >= beta) return beta;
+        if (alpha < stand_pat) alpha = stand_pat;
+    }
     if (depth <= -MAX_QUIESCENCE_DEPTH) return stand_pat;
     
-    auto captures = generateMoves(b, true);
+    auto captures = generateMoves(b, inCheck ? GEN_ALL : GEN_CAPTURES);
+    if (inCheck && captures.empty()) return -MATE + ply;
     scoreMoves(captures, b, nullptr, 0);
     
+    // Quiet checks on the first quiescence ply
+    if (!inCheck && depth == 0) {
+        auto checks = generateMoves(b, GEN_QUIET_CHECKS);
+        captures.insert(captures.end(), checks.begin(), checks.end());
+    }
+    
     for (const auto& m : captures) {
         // Delta pruning
-        int gain = 200; // Expected gain from capture
-        if (m.piece != PAWN) gain = 900;
-        if (stand_pat + gain < alpha && depth < -1) continue;
+        int gain = m.piece == PAWN ? params->deltaPawn : params->deltaPiece; // Expected gain from capture
+        if (!inCheck && m.captured != -1 && stand_pat + gain < alpha && depth < -1) continue;
         
         Board copy = b;
         makeMove(copy, m);
         
-        int score = -quiescence(copy, -beta, -alpha, depth - 1);
+        int score = -quiescence(copy, -beta, -alpha, depth - 1, ply + 1);
         
         if (score >= beta) return beta;
         if (score > alpha) alpha = score;
@@ -623,171 +1641,544 @@ int quiescence(Board& b, int alpha, int beta, int depth) {
     return alpha;
 }
 
+int search(Board& b, int depth, int alpha, int beta, Move& bestMove, int ply, bool nullMove = true);
+
+// Parallel search: Young Brothers Wait. Once the first move of a node has
+// been searched, the remaining moves are published as a split point on
+// the owner's deque; idle threads steal split points and search moves
+// from them until they run out or one of them fails high.
+const int MIN_SPLIT_DEPTH = 4;
+
+struct SplitPoint {
+    Board* board;
+    MovePicker* picker;
+    SplitPoint* parent;       // Enclosing split point of the owner
+    Move* rootBest;           // Root best move when splitting at ply 0
+    int depth, beta, ply;
+    bool inCheck;
+    
+    std::mutex lock;          // Guards picker and the fields below
+    int alpha, bestScore, moveCount;
+    Move bestMove;
+    
+    std::atomic<bool> exhausted;
+    std::atomic<bool> cutoff;
+    std::atomic<int> workers; // Helpers currently searching here
+};
+
+struct SearchThread {
+    int index;
+    std::thread handle;
+    std::mutex dequeLock;
+    std::deque<SplitPoint*> splitPoints; // Owner works at the back, thieves take from the front
+    SplitPoint* activeSplit;             // Innermost split point this thread works under
+    long long wakeUs, firstNodeUs;       // Latency from go, in microseconds (-1 if none)
+    
+    // A fail high at any enclosing split point makes this subtree moot
+    bool cutoffOccurred() const {
+        for (SplitPoint* sp = activeSplit; sp; sp = sp->parent)
+            if (sp->cutoff.load(std::memory_order_relaxed)) return true;
+        return false;
+    }
+};
+
+SearchThread searchThreads[MAX_THREADS];
+thread_local SearchThread* thisThread = &searchThreads[0];
+int activeThreads = 1;
+std::atomic<bool> searching(false);
+std::atomic<int> idleThreads(0);
+std::atomic<long long> splitCount(0), joinCount(0);
+std::chrono::steady_clock::time_point goTime;
+
+long long microsSince(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t).count();
+}
+
+// Persistent helper threads. They are created when Threads is set and
+// park on a condition variable (a futex on Linux) between jobs, so a
+// go costs one notify instead of thread creation and join.
+struct ThreadPool {
+    std::mutex lock;
+    std::condition_variable wake, done;
+    std::function<void(int)> job;
+    unsigned generation;
+    int running; // Helpers still executing the current job
+    int size;    // Helpers plus the calling thread
+    bool exiting;
+    
+    ThreadPool() : generation(0), running(0), size(1), exiting(false) {}
+    
+    void helperMain(int index, unsigned seen) {
+        thisThread = &searchThreads[index];
+        localStats = &threadStats[index];
+        l1Attach(index);
+        while (true) {
+            std::function<void(int)> task;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&] { return exiting || generation != seen; });
+                if (exiting) return;
+                seen = generation;
+                task = job;
+            }
+            thisThread->wakeUs = microsSince(goTime);
+            task(index);
+            std::lock_guard<std::mutex> guard(lock);
+            if (--running == 0) done.notify_all();
+        }
+    }
+    
+    // Start a job on every helper; the caller takes part as thread 0
+    void run(std::function<void(int)> task) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            job = task;
+            running = size - 1;
+            generation++;
+        }
+        wake.notify_all();
+    }
+    
+    void wait() {
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [&] { return running == 0; });
+    }
+    
+    void resize(int threads) {
+        if (threads == size) return;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            exiting = true;
+        }
+        wake.notify_all();
+        for (int i = 1; i < size; i++) {
+            searchThreads[i].handle.join();
+        }
+        exiting = false;
+        size = threads;
+        for (int i = 1; i < size; i++) {
+            searchThreads[i].handle = std::thread(&ThreadPool::helperMain, this, i, generation);
+        }
+    }
+} threadPool;
+
+void runOnPool(const std::function<void(int, int)>& task) {
+    int count = threadPool.size;
+    threadPool.run([&](int index) { task(index, count); });
+    task(0, count);
+    threadPool.wait();
+}
+
+// Per-node decisions, shared by search() and ResumableSearch so the two
+// cannot drift apart.
+
+// Transposition table cutoff: true with the score to return
+bool ttCutoff(const TTData& tt, int depth, int alpha, int beta, int& score) {
+    if (tt.depth < depth) return false;
+    if (tt.flag == TT_EXACT) score = tt.score;
+    else if (tt.flag == TT_ALPHA && tt.score <= alpha) score = alpha;
+    else if (tt.flag == TT_BETA && tt.score >= beta) score = beta;
+    else return false;
+    return true;
+}
+
+// Null move pruning: true with the position after passing and the depth
+// to search it to
+bool nullMoveChild(const Board& b, int depth, int ply, bool nullMove, bool inCheck,
+                   Board& child, int& childDepth) {
+    if (!nullMove || inCheck || depth < 3 || ply == 0) return false;
+    child = b;
+    child.side = 1 - child.side;
+    child.hash ^= zobristSide;
+    child.ep = -1;
+    setCheckInfo(child);
+    int R = depth > 6 ? params->nullReductionDeep : params->nullReduction; // Reduction factor
+    childDepth = depth - 1 - R;
+    return true;
+}
+
+// Futility pruning of late quiet moves near the leaves - checking moves are exempt
+bool futile(Board& b, const Move& m, int depth, int alpha, int moveCount, bool inCheck, bool checks,
+            int& rawEval, int& staticEval) {
+    if (depth > 2 || inCheck || moveCount <= 8 || m.captured != -1 || checks) return false;
+    lazyEval(b, rawEval, staticEval);
+    return staticEval + depth * params->futilityMargin < alpha;
+}
+
+// Late Move Reduction (LMR) - never for checking moves
+int lmrReduction(const Board& b, const Move& m, int depth, int ply, int moveCount, bool inCheck, bool checks) {
+    if (moveCount <= params->lmrMoves1 || depth < 3 || inCheck || checks || m.captured != -1 || m.promo != 0)
+        return 0;
+    int reduction = moveCount > params->lmrMoves3 ? 3 : moveCount > params->lmrMoves2 ? 2 : 1;
+    
+    // Reduce less for killers and high history scores
+    if (killerMoves.isKiller(m, ply) || historyTable.get(b.side, m.from, m.to) > 5000) {
+        reduction = std::max(0, reduction - 1);
+    }
+    return reduction;
+}
+
+// Principal Variation Search: which search a move needs after one that
+// returned value. The first pass is FIRST (full window) for the first
+// move, else NULL_WINDOW; later passes are unreduced with a full window.
+enum { PASS_FIRST, PASS_NULL_WINDOW, PASS_PVS_RESEARCH, PASS_LMR_RESEARCH, PASS_DONE };
+
+int nextPass(int pass, int value, int alpha, int beta, int reduction) {
+    if (pass == PASS_NULL_WINDOW && value > alpha && value < beta) return PASS_PVS_RESEARCH; // Failed high
+    if (pass != PASS_LMR_RESEARCH && reduction > 0 && value > alpha) return PASS_LMR_RESEARCH; // Reduced search failed high
+    return PASS_DONE;
+}
+
+// A searched move's score: true on a beta cutoff. Quiet moves that raise
+// alpha gain history, quiet moves that cut off become killers.
+bool recordScore(const Board& b, const Move& m, int score, int depth, int ply, int& alpha, int beta,
+                 int& bestScore, Move& localBest) {
+    if (score > bestScore) {
+        bestScore = score;
+        localBest = m;
+    }
+    if (score > alpha) {
+        alpha = score;
+        if (m.captured == -1) {
+            historyTable.update(b.side, m.from, m.to, depth);
+        }
+    }
+    if (alpha < beta) return false;
+    if (m.captured == -1) {
+        killerMoves.update(m, ply);
+    }
+    return true;
+}
+
+// End of a node: store the result and correct the eval from it
+void storeNode(Board& b, int depth, int bestScore, int origAlpha, int beta, const Move& localBest,
+               bool inCheck, bool restricted, int& rawEval, int& staticEval) {
+    int flag = TT_EXACT;
+    if (bestScore <= origAlpha) {
+        flag = TT_ALPHA;
+    } else if (bestScore >= beta) {
+        flag = TT_BETA;
+    }
+    if (!restricted) ttStore(b.hash, depth, bestScore, flag, packMove(localBest));
+    
+    // Learn from quiet results whose bound says something about the eval
+    if (!inCheck && localBest.captured == -1 && localBest.promo == 0 && std::abs(bestScore) < MATE - 1000) {
+        lazyEval(b, rawEval, staticEval);
+        if (!(flag == TT_BETA && bestScore <= staticEval) && !(flag == TT_ALPHA && bestScore >= staticEval)) {
+            correctionHistory.update(b, bestScore - rawEval, depth);
+        }
+    }
+}
+
+// Search one move of a node: LMR, then PVS with re-searches
+int searchMove(Board& b, const Move& m, int depth, int alpha, int beta, int ply,
+               int moveCount, bool inCheck, bool checks) {
+    int reduction = lmrReduction(b, m, depth, ply, moveCount, inCheck, checks);
+    
+    Board copy = b;
+    makeMove(copy, m);
+    Move dummy;
+    
+    int pass = moveCount == 1 ? PASS_FIRST : PASS_NULL_WINDOW;
+    int score = -search(copy, depth - 1 - reduction, pass == PASS_FIRST ? -beta : -alpha - 1, -alpha,
+                        dummy, ply + 1, true);
+    while ((pass = nextPass(pass, score, alpha, beta, reduction)) != PASS_DONE) {
+        score = -search(copy, depth - 1, -beta, -alpha, dummy, ply + 1, true);
+    }
+    return score;
+}
+
+// Take moves from a split point until none are left or it is cut off
+void workSplitPoint(SplitPoint* sp) {
+    SplitPoint* saved = thisThread->activeSplit;
+    thisThread->activeSplit = sp;
+    Board& b = *sp->board;
+    
+    while (true) {
+        Move m;
+        int moveCount, alpha;
+        {
+            std::lock_guard<std::mutex> guard(sp->lock);
+            if (sp->cutoff || !sp->picker->next(m)) {
+                sp->exhausted = true;
+                break;
+            }
+            moveCount = ++sp->moveCount;
+            alpha = sp->alpha;
+        }
+        
+        int score = searchMove(b, m, sp->depth, alpha, sp->beta, sp->ply,
+                               moveCount, sp->inCheck, givesCheck(b, m));
+        if (thisThread->cutoffOccurred()) break;
+        
+        std::lock_guard<std::mutex> guard(sp->lock);
+        if (score > sp->bestScore) {
+            sp->bestScore = score;
+            sp->bestMove = m;
+            if (sp->rootBest) *sp->rootBest = m;
+        }
+        if (score > sp->alpha) {
+            sp->alpha = score;
+            if (m.captured == -1) {
+                historyTable.update(b.side, m.from, m.to, sp->depth);
+            }
+            if (sp->alpha >= sp->beta) {
+                sp->cutoff = true;
+            }
+        }
+    }
+    
+    thisThread->activeSplit = saved;
+}
+
+bool isBelow(const SplitPoint* sp, const SplitPoint* ancestor) {
+    for (; sp; sp = sp->parent)
+        if (sp == ancestor) return true;
+    return false;
+}
+
+// Join a split point published by another thread. With 'within' set, only
+// split points below it qualify: a waiting owner helping its own helpers.
+bool stealWork(SplitPoint* within) {
+    for (int i = 1; i < activeThreads; i++) {
+        SearchThread& victim = searchThreads[(thisThread->index + i) % activeThreads];
+        SplitPoint* sp = nullptr;
+        {
+            std::lock_guard<std::mutex> guard(victim.dequeLock);
+            for (SplitPoint* candidate : victim.splitPoints) {
+                if (candidate->exhausted || candidate->cutoff) continue;
+                if (within && !isBelow(candidate, within)) continue;
+                sp = candidate;
+                sp->workers++;
+                break;
+            }
+        }
+        if (sp) {
+            joinCount++;
+            if (thisThread->firstNodeUs < 0) thisThread->firstNodeUs = microsSince(goTime);
+            if (!within) idleThreads--;
+            workSplitPoint(sp);
+            if (!within) idleThreads++;
+            sp->workers.fetch_sub(1, std::memory_order_release);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Share the remaining moves of a node with idle threads and wait for all
+// of them; the node's alpha, best score and move count are updated.
+void split(Board& b, MovePicker& picker, int depth, int& alpha, int beta, int ply, bool inCheck,
+           int& bestScore, Move& localBest, int& moveCount, Move* rootBest) {
+    SplitPoint sp;
+    sp.board = &b;
+    sp.picker = &picker;
+    sp.parent = thisThread->activeSplit;
+    sp.rootBest = rootBest;
+    sp.depth = depth;
+    sp.beta = beta;
+    sp.ply = ply;
+    sp.inCheck = inCheck;
+    sp.alpha = alpha;
+    sp.bestScore = bestScore;
+    sp.moveCount = moveCount;
+    sp.bestMove = localBest;
+    sp.exhausted = false;
+    sp.cutoff = false;
+    sp.workers = 0;
+    
+    {
+        std::lock_guard<std::mutex> guard(thisThread->dequeLock);
+        thisThread->splitPoints.push_back(&sp);
+    }
+    splitCount++;
+    
+    workSplitPoint(&sp);
+    
+    {
+        std::lock_guard<std::mutex> guard(thisThread->dequeLock);
+        thisThread->splitPoints.pop_back();
+    }
+    while (sp.workers.load(std::memory_order_acquire) > 0) {
+        if (!stealWork(&sp)) std::this_thread::yield();
+    }
+    
+    alpha = sp.alpha;
+    bestScore = sp.bestScore;
+    localBest = sp.bestMove;
+    moveCount = sp.moveCount;
+}
+
+// Deterministic mode: after the first root move, the rest are dealt out
+// round-robin by index and searched in one round against the same alpha.
+// Each thread writes only to its own TT overlay, so what a thread sees
+// depends on nothing but the thread count; the overlays are committed
+// and the results combined in a fixed order once the round is over.
+TTOverlay ttOverlays[MAX_THREADS];
+
+void splitRoot(Board& b, MovePicker& picker, int depth, int& alpha, int beta, bool inCheck,
+               int& bestScore, Move& localBest, int& moveCount) {
+    std::vector<Move> moves;
+    Move m;
+    while (picker.next(m)) moves.push_back(m);
+    
+    int count = (int)moves.size();
+    int roundAlpha = alpha, firstCount = moveCount;
+    std::vector<int> scores(count);
+    
+    auto task = [&](int index) {
+        ttOverlay = &ttOverlays[index];
+        for (int i = index; i < count; i += activeThreads) {
+            scores[i] = searchMove(b, moves[i], depth, roundAlpha, beta, 0,
+                                   firstCount + 1 + i, inCheck, givesCheck(b, moves[i]));
+        }
+        ttOverlay = nullptr;
+    };
+    splitCount++;
+    joinCount += std::min(count, activeThreads - 1);
+    threadPool.run(task);
+    task(0);
+    threadPool.wait();
+    
+    for (int i = 0; i < activeThreads; i++) ttCommit(ttOverlays[i]);
+    
+    for (int i = 0; i < count; i++) {
+        moveCount++;
+        if (scores[i] > bestScore) {
+            bestScore = scores[i];
+            localBest = moves[i];
+        }
+        if (scores[i] > alpha) {
+            alpha = scores[i];
+            if (moves[i].captured == -1) {
+                historyTable.update(b.side, moves[i].from, moves[i].to, depth);
+            }
+            if (alpha >= beta) break;
+        }
+    }
+}
+
+// Helper threads look for split points until the search ends
+void helperSearch(int) {
+    idleThreads++;
+    while (searching.load(std::memory_order_acquire)) {
+        if (!stealWork(nullptr)) std::this_thread::yield();
+    }
+    idleThreads--;
+}
+
 // Main alpha-beta search with advanced pruning
-int search(Board& b, int depth, int alpha, int beta, Move& bestMove, int ply, bool nullMove = true) {
-    searchStats.nodes++;
+int search(Board& b, int depth, int alpha, int beta, Move& bestMove, int ply, bool nullMove) {
+    localStats->nodes.inc();
+    localStats->seldepth.max(ply);
+    if (thisThread->activeSplit && thisThread->cutoffOccurred()) return 0;
+    if (stopRequested()) return 0;
     
     // Check extension
     bool inCheck = isInCheck(b);
     if (inCheck) depth++;
     
     // Transposition table lookup
-    int ttIndex = b.hash % TT_SIZE;
-    TTEntry* ttEntry = &transpositionTable[ttIndex];
+    TTData tt;
+    bool ttHit = ttProbe(b.hash, tt, depth);
+    if (ttHit) localStats->ttHits.inc();
     Move ttMove;
     
-    if (ttEntry->hash == b.hash && ttEntry->depth >= depth) {
-        if (ttEntry->flag == TT_EXACT) {
-            if (ply == 0) {
-                bestMove.from = ttEntry->bestMove & 63;
-                bestMove.to = (ttEntry->bestMove >> 6) & 63;
-                bestMove.piece = (ttEntry->bestMove >> 12) & 7;
-            }
-            return ttEntry->score;
+    // A root restricted to some moves cannot trust what the table says
+    bool restricted = ply == 0 && !rootMoves.empty();
+    
+    int ttScore;
+    if (ttHit && !restricted && ttCutoff(tt, depth, alpha, beta, ttScore)) {
+        if (ply == 0 && tt.flag == TT_EXACT) {
+            bestMove = unpackMove(tt.bestMove);
         }
-        if (ttEntry->flag == TT_ALPHA && ttEntry->score <= alpha) return alpha;
-        if (ttEntry->flag == TT_BETA && ttEntry->score >= beta) return beta;
+        return ttScore;
     }
     
-    if (ttEntry->hash == b.hash && ttEntry->bestMove) {
-        ttMove.from = ttEntry->bestMove & 63;
-        ttMove.to = (ttEntry->bestMove >> 6) & 63;
-        ttMove.piece = (ttEntry->bestMove >> 12) & 7;
+    if (ttHit && tt.bestMove) {
+        ttMove = unpackMove(tt.bestMove);
     }
     
     if (depth <= 0) {
-        return quiescence(b, alpha, beta, 0);
+        return quiescence(b, alpha, beta, 0, ply);
     }
     
+    // Static eval, corrected for the pawn structure: computed when first needed
+    int rawEval = -INF, staticEval = -INF;
+    
     // Null move pruning
-    if (nullMove && !inCheck && depth >= 3 && ply > 0) {
-        Board copy = b;
-        copy.side = 1 - copy.side;
-        copy.hash ^= zobristSide;
-        copy.ep = -1;
-        
+    Board nullChild;
+    int nullDepth;
+    if (nullMoveChild(b, depth, ply, nullMove, inCheck, nullChild, nullDepth)) {
         Move dummy;
-        int R = depth > 6 ? 3 : 2; // Reduction factor
-        int score = -search(copy, depth - 1 - R, -beta, -beta + 1, dummy, ply + 1, false);
+        int score = -search(nullChild, nullDepth, -beta, -beta + 1, dummy, ply + 1, false);
         
         if (score >= beta) {
             return beta; // Null move cutoff
         }
     }
     
-    auto moves = generateMoves(b);
-    
-    if (moves.empty()) {
-        if (inCheck) return -MATE + ply;
-        return 0;
-    }
-    
-    scoreMoves(moves, b, ttEntry->hash == b.hash ? &ttMove : nullptr, ply);
-    
-    if (ply == 0 && !moves.empty()) {
-        bestMove = moves[0];
-    }
+    MovePicker picker(b, ttMove, ply);
     
     int moveCount = 0;
     int bestScore = -INF;
     Move localBest;
     int origAlpha = alpha;
+    Move m;
     
-    for (auto& m : moves) {
+    while (picker.next(m)) {
         moveCount++;
+        bool checks = givesCheck(b, m);
         
-        // Late Move Reduction (LMR)
-        int reduction = 0;
-        if (moveCount > 4 && depth >= 3 && !inCheck && 
-            !(b.occupied[1 - b.side] & (1ULL << m.to)) && m.promo == 0) {
-            
-            if (moveCount > 12) reduction = 3;
-            else if (moveCount > 6) reduction = 2;
-            else reduction = 1;
-            
-            // Reduce less for killers and high history scores
-            if (killerMoves.isKiller(&m, ply) || historyTable.get(b.side, m.from, m.to) > 5000) {
-                reduction = std::max(0, reduction - 1);
-            }
+        if (ply == 0 && moveCount == 1) {
+            bestMove = m;
         }
         
-        Board copy = b;
-        makeMove(copy, m);
-        
-        int score;
-        
-        // Principal Variation Search (PVS)
-        if (moveCount == 1) {
-            // Search first move with full window
-            Move dummy;
-            score = -search(copy, depth - 1 - reduction, -beta, -alpha, dummy, ply + 1, true);
-        } else {
-            // Search with null window
-            Move dummy;
-            score = -search(copy, depth - 1 - reduction, -alpha - 1, -alpha, dummy, ply + 1, true);
-            
-            // Re-search if failed high
-            if (score > alpha && score < beta) {
-                score = -search(copy, depth - 1, -beta, -alpha, dummy, ply + 1, true);
-            }
+        if (futile(b, m, depth, alpha, moveCount, inCheck, checks, rawEval, staticEval)) {
+            continue; // Skip this quiet move
         }
         
-        // Re-search without reduction if reduced search failed high
-        if (reduction > 0 && score > alpha) {
-            Move dummy;
-            score = -search(copy, depth - 1, -beta, -alpha, dummy, ply + 1, true);
-        }
+        int score = searchMove(b, m, depth, alpha, beta, ply, moveCount, inCheck, checks);
         
-        if (score > bestScore) {
-            bestScore = score;
-            localBest = m;
-            
-            if (ply == 0) {
-                bestMove = m;
-            }
+        if (ply == 0 && score > bestScore) {
+            bestMove = m;
         }
-        
-        if (score > alpha) {
-            alpha = score;
-            
-            // Update history
-            if (!(b.occupied[1 - b.side] & (1ULL << m.to))) {
-                historyTable.update(b.side, m.from, m.to, depth);
-            }
+        if (recordScore(b, m, score, depth, ply, alpha, beta, bestScore, localBest)) {
+            break; // Beta cutoff
         }
         
-        if (alpha >= beta) {
-            // Beta cutoff - update killers
-            if (!(b.occupied[1 - b.side] & (1ULL << m.to))) {
-                killerMoves.update(&m, ply);
+        if (moveCount == 1 && ply == 0 && activeThreads > 1 && depth >= MIN_SPLIT_DEPTH &&
+            uciOptions.deterministic) {
+            splitRoot(b, picker, depth, alpha, beta, inCheck, bestScore, localBest, moveCount);
+            bestMove = localBest;
+            if (alpha >= beta && localBest.captured == -1) {
+                killerMoves.update(localBest, ply);
             }
             break;
         }
         
-        // Futility pruning
-        if (depth <= 2 && !inCheck && moveCount > 8 && 
-            !(b.occupied[1 - b.side] & (1ULL << m.to))) {
-            int futilityMargin = depth * 100;
-            if (b.evaluate() + futilityMargin < alpha) {
-                break; // Skip remaining moves
+        // Young Brothers Wait: the eldest brother is done, share the rest
+        if (moveCount == 1 && activeThreads > 1 && depth >= MIN_SPLIT_DEPTH &&
+            idleThreads.load(std::memory_order_relaxed) > 0 && !thisThread->cutoffOccurred()) {
+            split(b, picker, depth, alpha, beta, ply, inCheck, bestScore, localBest, moveCount,
+                  ply == 0 ? &bestMove : nullptr);
+            if (alpha >= beta && localBest.captured == -1) {
+                killerMoves.update(localBest, ply);
             }
+            break;
         }
     }
     
-    // Store in transposition table
-    ttEntry->hash = b.hash;
-    ttEntry->depth = depth;
-    ttEntry->score = bestScore;
-    ttEntry->bestMove = localBest.from | (localBest.to << 6) | (localBest.piece << 12);
+    // Results below a cut split point, or of a stopped search, are incomplete
+    if (thisThread->activeSplit && thisThread->cutoffOccurred()) return 0;
+    if (stopRequested()) return 0;
     
-    if (bestScore <= origAlpha) {
-        ttEntry->flag = TT_ALPHA;
-    } else if (bestScore >= beta) {
-        ttEntry->flag = TT_BETA;
-    } else {
-        ttEntry->flag = TT_EXACT;
+    // No legal moves: checkmate or stalemate
+    if (moveCount == 0) {
+        return inCheck ? -MATE + ply : 0;
     }
     
+    storeNode(b, depth, bestScore, origAlpha, beta, localBest, inCheck, restricted, rawEval, staticEval);
     return bestScore;
 }
 
@@ -796,12 +2187,13 @@ int iterativeDeepening(Board& b, int maxDepth, Move& bestMove, int timeLimit = 0
     int score = 0;
     int alpha = -INF;
     int beta = INF;
-    int window = 50;
+    int window = params->aspirationWindow;
     
     searchStats.init();
     
     for (int depth = 1; depth <= maxDepth; depth++) {
         searchStats.currentDepth = depth;
+        Move completed = bestMove;
         
         // Aspiration window search
         if (depth >= 4) {
@@ -814,9 +2206,15 @@ int iterativeDeepening(Board& b, int maxDepth, Move& bestMove, int timeLimit = 0
         // Re-search if outside window
         if (tempScore <= alpha || tempScore >= beta) {
             tempScore = search(b, depth, -INF, INF, bestMove, 0);
-            window = 50; // Reset window
+            window = params->aspirationWindow; // Reset window
         } else {
-            window = 25; // Narrow window for next iteration
+            window = params->aspirationNarrow; // Narrow window for next iteration
+        }
+        
+        // Stopped: keep the move of the last finished iteration
+        if (stopRequested()) {
+            bestMove = completed;
+            break;
         }
         
         score = tempScore;
@@ -824,7 +2222,8 @@ int iterativeDeepening(Board& b, int maxDepth, Move& bestMove, int timeLimit = 0
         // Time management
         if (timeLimit > 0) {
             auto elapsed = std::chrono::steady_clock::now() - searchStats.startTime;
-            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+            long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+            if (clockNodesPerMs) ms = (searchStats.nodes() + searchStats.qnodes()) / clockNodesPerMs;
             
             // Stop if we've used 40% of our time and depth > 4
             if (ms > timeLimit * 0.4 && depth > 4) {
@@ -844,25 +2243,14 @@ int iterativeDeepening(Board& b, int maxDepth, Move& bestMove, int timeLimit = 0
             std::cout << "cp " << score;
         }
         
-        std::cout << " nodes " << searchStats.nodes;
+        std::cout << " seldepth " << searchStats.seldepth();
+        std::cout << " nodes " << searchStats.nodes();
         std::cout << " nps " << searchStats.nps();
+        std::cout << " tbhits " << searchStats.tbhits();
         std::cout << " pv ";
         
         // Output best move
-        std::string move_str;
-        move_str += (bestMove.from % 8) + 'a';
-        move_str += (bestMove.from / 8) + '1';
-        move_str += (bestMove.to % 8) + 'a';
-        move_str += (bestMove.to / 8) + '1';
-        if (bestMove.promo) {
-            switch (bestMove.promo) {
-                case QUEEN: move_str += 'q'; break;
-                case ROOK: move_str += 'r'; break;
-                case BISHOP: move_str += 'b'; break;
-                case KNIGHT: move_str += 'n'; break;
-            }
-        }
-        std::cout << move_str << "\n";
+        std::cout << moveToString(bestMove) << "\n";
         
         // Stop on mate found
         if (std::abs(score) >= MATE - 1000) {
@@ -873,48 +2261,1264 @@ int iterativeDeepening(Board& b, int maxDepth, Move& bestMove, int timeLimit = 0
     return score;
 }
 
-// Initialize lookup tables
-void initTables() {
-    for (int sq = 0; sq < 64; sq++) {
-        int x = sq % 8, y = sq / 8;
-        
-        KingMoves[sq] = 0;
-        for (int dx = -1; dx <= 1; dx++) {
-            for (int dy = -1; dy <= 1; dy++) {
-                if (dx == 0 && dy == 0) continue;
-                int nx = x + dx, ny = y + dy;
-                if (nx >= 0 && nx < 8 && ny >= 0 && ny < 8) {
-                    KingMoves[sq] |= 1ULL << (ny * 8 + nx);
-                }
-            }
-        }
-        
-        KnightMoves[sq] = 0;
-        int kdx[] = {2, 2, -2, -2, 1, 1, -1, -1};
-        int kdy[] = {1, -1, 1, -1, 2, -2, 2, -2};
-        for (int i = 0; i < 8; i++) {
-            int nx = x + kdx[i], ny = y + kdy[i];
-            if (nx >= 0 && nx < 8 && ny >= 0 && ny < 8) {
-                KnightMoves[sq] |= 1ULL << (ny * 8 + nx);
-            }
+// Helper latency of the last search: go to running, go to first node
+void reportWakeup() {
+    long long wakeSum = 0, wakeMax = 0, nodeSum = 0, nodeMax = 0;
+    int searched = 0;
+    for (int i = 1; i < activeThreads; i++) {
+        wakeSum += searchThreads[i].wakeUs;
+        wakeMax = std::max(wakeMax, searchThreads[i].wakeUs);
+        if (searchThreads[i].firstNodeUs >= 0) {
+            nodeSum += searchThreads[i].firstNodeUs;
+            nodeMax = std::max(nodeMax, searchThreads[i].firstNodeUs);
+            searched++;
         }
     }
+    std::cout << "info string wakeup avg " << wakeSum / (activeThreads - 1) << " us max " << wakeMax << " us";
+    if (searched) {
+        std::cout << " first node avg " << nodeSum / searched << " us max " << nodeMax << " us";
+    }
+    std::cout << " (" << searched << "/" << activeThreads - 1 << " helpers searched)\n";
+}
+
+// Run a search on the calling thread with the pool's helpers alongside
+int thinkLocal(Board& b, int maxDepth, Move& bestMove, int timeLimit) {
+    goTime = std::chrono::steady_clock::now();
+    activeThreads = threadPool.size;
+    splitCount = joinCount = 0;
+    for (int i = 0; i < activeThreads; i++) {
+        searchThreads[i].wakeUs = searchThreads[i].firstNodeUs = -1;
+    }
+    searchThreads[0].wakeUs = searchThreads[0].firstNodeUs = 0;
     
-    initZobrist();
-    historyTable.init();
-    killerMoves.init();
-    memset(transpositionTable, 0, sizeof(transpositionTable));
+    // Deterministic rounds use the pool themselves; helpers stay parked
+    if (uciOptions.deterministic) {
+        return iterativeDeepening(b, maxDepth, bestMove, timeLimit);
+    }
+    
+    searching = true;
+    threadPool.run(helperSearch);
+    
+    int score = iterativeDeepening(b, maxDepth, bestMove, timeLimit);
+    
+    searching = false;
+    threadPool.wait();
+    if (activeThreads > 1) reportWakeup();
+    return score;
 }
 
-// Move parser for UCI
-bool parseMove(Board& b, std::string move_str, Move& parsed_move) {
-    auto moves = generateMoves(b);
-    int from = (move_str[0] - 'a') + (move_str[1] - '1') * 8;
-    int to = (move_str[2] - 'a') + (move_str[3] - '1') * 8;
-    int promo_piece = 0;
+// Cluster search. A master (ClusterPort set) accepts worker processes,
+// local or remote, started with "cluster <host> <port>". At each search
+// the root moves are dealt out between the master and its workers; each
+// node runs iterativeDeepening on its share and the master keeps the best
+// result. Entries of depth >= CLUSTER_SHARE_DEPTH are streamed between
+// nodes while they search. The protocol is one text command per line.
+// The master listens on ClusterBind (loopback unless set otherwise) and a
+// worker must open with "hello <ClusterSecret>" before anything it sends
+// is used. Results are checked against the moves that worker was given.
+// A search's time limit is sent with the master's nodestime rate, so a
+// worker spends it as nodes whenever the master's clock runs on nodes.
+const int CLUSTER_SHARE_DEPTH = 6;
+const int CLUSTER_GRACE_MS = 2000; // Wait for workers after our own search
 
-    if (move_str.length() == 5) {
-        switch (move_str[4]) {
+std::string clusterBind = "127.0.0.1";
+std::string clusterSecret;
+
+void newGame();
+
+struct ClusterLink {
+    int fd;
+    std::mutex writeLock;
+    std::thread reader;
+    bool alive, hasResult; // alive: said hello and still connected
+    int move, score, depth;
+    long long nodes;
+    std::vector<Move> assigned; // Root moves of the current search
+};
+
+std::vector<ClusterLink*> clusterLinks; // Master: one per worker
+std::mutex clusterLock;                 // Guards clusterLinks and results
+std::condition_variable clusterResult;
+std::thread clusterAcceptor, clusterPumper;
+int clusterListenFd = -1;
+ClusterLink* clusterMaster = nullptr;   // Worker: link to the master
+std::atomic<bool> clusterPumping(false);
+long long clusterNodes = 0;             // Worker nodes of the last search
+
+#ifndef _WIN32
+bool sendLine(ClusterLink* link, const std::string& line) {
+    std::lock_guard<std::mutex> guard(link->writeLock);
+    std::string data = line + "\n";
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(link->fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+bool readLine(int fd, std::string& buffer, std::string& line) {
+    while (true) {
+        size_t eol = buffer.find('\n');
+        if (eol != std::string::npos) {
+            line = buffer.substr(0, eol);
+            buffer.erase(0, eol + 1);
+            return true;
+        }
+        char chunk[4096];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buffer.append(chunk, n);
+    }
+}
+
+ClusterLink* newLink(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    ClusterLink* link = new ClusterLink();
+    link->fd = fd;
+    link->alive = false;
+    link->hasResult = false;
+    return link;
+}
+
+// "tt <hash> <data> ..." from a peer goes straight into the table
+void receiveEntries(std::istringstream& iss) {
+    U64 hash, data;
+    while (iss >> hash >> data) ttWrite(hash, data);
+}
+
+// Master side of a worker connection
+void clusterReader(ClusterLink* link) {
+    std::string buffer, line;
+    if (readLine(link->fd, buffer, line) && line == "hello " + clusterSecret) {
+        std::lock_guard<std::mutex> guard(clusterLock);
+        link->alive = true;
+    } else {
+        std::lock_guard<std::mutex> guard(clusterLock);
+        link->hasResult = true;
+        return;
+    }
+    while (readLine(link->fd, buffer, line)) {
+        std::istringstream iss(line);
+        std::string cmd;
+        iss >> cmd;
+        if (cmd == "tt") {
+            receiveEntries(iss);
+            std::lock_guard<std::mutex> guard(clusterLock);
+            for (ClusterLink* other : clusterLinks)
+                if (other != link && other->alive) sendLine(other, line);
+        } else if (cmd == "result") {
+            std::lock_guard<std::mutex> guard(clusterLock);
+            iss >> link->move >> link->score >> link->depth >> link->nodes;
+            link->hasResult = true;
+            clusterResult.notify_all();
+        }
+    }
+    std::lock_guard<std::mutex> guard(clusterLock);
+    link->alive = false;
+    link->hasResult = true;
+    clusterResult.notify_all();
+}
+
+void clusterAccept() {
+    int fd;
+    while ((fd = accept(clusterListenFd, nullptr, nullptr)) >= 0) {
+        ClusterLink* link = newLink(fd);
+        std::lock_guard<std::mutex> guard(clusterLock);
+        clusterLinks.push_back(link);
+        link->reader = std::thread(clusterReader, link);
+    }
+}
+
+// Close the listening socket and every worker connection
+void clusterClose() {
+    if (clusterListenFd >= 0) {
+        shutdown(clusterListenFd, SHUT_RDWR);
+        close(clusterListenFd);
+        clusterAcceptor.join();
+        clusterListenFd = -1;
+    }
+    for (ClusterLink* link : clusterLinks) {
+        shutdown(link->fd, SHUT_RDWR);
+        link->reader.join();
+        close(link->fd);
+        delete link;
+    }
+    clusterLinks.clear();
+}
+
+bool clusterListen(int port) {
+    clusterClose();
+    if (port == 0) return true;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, clusterBind.c_str(), &addr.sin_addr) != 1) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    clusterListenFd = fd;
+    clusterAcceptor = std::thread(clusterAccept);
+    return true;
+}
+
+// While searching, flush new deep entries to the peers every few ms
+void clusterPump() {
+    while (clusterPumping.load(std::memory_order_acquire)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::vector<std::pair<U64, U64> > entries;
+        {
+            std::lock_guard<std::mutex> guard(ttOutboxLock);
+            entries.swap(ttOutbox);
+        }
+        if (entries.empty()) continue;
+        std::string line = "tt";
+        for (const auto& e : entries) line += " " + std::to_string(e.first) + " " + std::to_string(e.second);
+        if (clusterMaster) {
+            sendLine(clusterMaster, line);
+        } else {
+            std::lock_guard<std::mutex> guard(clusterLock);
+            for (ClusterLink* link : clusterLinks)
+                if (link->alive) sendLine(link, line);
+        }
+    }
+}
+
+void startPump() {
+    clusterShareDepth = CLUSTER_SHARE_DEPTH;
+    clusterPumping = true;
+    clusterPumper = std::thread(clusterPump);
+}
+
+void stopPump() {
+    clusterPumping = false;
+    clusterPumper.join();
+    clusterShareDepth = 0;
+    std::lock_guard<std::mutex> guard(ttOutboxLock);
+    ttOutbox.clear();
+}
+
+// Deal the root moves out, search our share, then gather every result
+int clusterThink(Board& b, int maxDepth, Move& bestMove, int timeLimit) {
+    std::vector<ClusterLink*> workers;
+    {
+        std::lock_guard<std::mutex> guard(clusterLock);
+        for (ClusterLink* link : clusterLinks)
+            if (link->alive) workers.push_back(link);
+    }
+    std::vector<Move> moves = generateMoves(b);
+    scoreMoves(moves, b, nullptr, 0);
+    int nodes = std::min((int)workers.size() + 1, (int)moves.size());
+    if (nodes <= 1) return thinkLocal(b, maxDepth, bestMove, timeLimit);
+    workers.resize(nodes - 1);
+    
+    std::string position = "position " + b.fen();
+    for (int k = 1; k < nodes; k++) {
+        // The time limit is in ms of the master's clock, so workers get its node rate too
+        std::string search = "search " + std::to_string(maxDepth) + " " + std::to_string(timeLimit) + " " +
+                             std::to_string(clockNodesPerMs);
+        std::lock_guard<std::mutex> guard(clusterLock);
+        workers[k - 1]->assigned.clear();
+        for (int i = k; i < (int)moves.size(); i += nodes) {
+            search += " " + std::to_string(packMove(moves[i]));
+            workers[k - 1]->assigned.push_back(moves[i]);
+        }
+        workers[k - 1]->hasResult = false;
+        sendLine(workers[k - 1], position);
+        sendLine(workers[k - 1], search);
+    }
+    for (int i = 0; i < (int)moves.size(); i += nodes) rootMoves.push_back(moves[i]);
+    
+    auto start = std::chrono::steady_clock::now();
+    startPump();
+    int score = thinkLocal(b, maxDepth, bestMove, timeLimit);
+    int depth = searchStats.currentDepth;
+    stopPump();
+    rootMoves.clear();
+    
+    // Workers that have not answered within the grace period are dropped
+    long long waitMs = std::max<long long>(CLUSTER_GRACE_MS, microsSince(start) / 1000);
+    std::unique_lock<std::mutex> guard(clusterLock);
+    clusterResult.wait_for(guard, std::chrono::milliseconds(waitMs), [&] {
+        for (ClusterLink* link : workers)
+            if (!link->hasResult) return false;
+        return true;
+    });
+    clusterNodes = 0;
+    bool improved = false;
+    for (int k = 1; k < nodes; k++) {
+        ClusterLink* link = workers[k - 1];
+        if (!link->hasResult) {
+            std::cout << "info string cluster node " << k << " timed out\n";
+            link->alive = false;
+            shutdown(link->fd, SHUT_RDWR);
+            continue;
+        }
+        if (!link->alive) continue;
+        
+        // Only a move this worker was given, at least as deep as ours, counts
+        const Move* move = nullptr;
+        for (const Move& m : link->assigned)
+            if (packMove(m) == link->move && isLegal(b, m)) move = &m;
+        clusterNodes += link->nodes;
+        std::cout << "info string cluster node " << k << " depth " << link->depth << " score cp " << link->score
+                  << " nodes " << link->nodes << (move ? "" : " (rejected move)") << "\n";
+        if (!move || link->depth < depth) continue;
+        if (link->depth > depth || link->score > score) {
+            depth = link->depth;
+            score = link->score;
+            bestMove = *move;
+            improved = true;
+        }
+    }
+    
+    // The last info line must agree with the bestmove that follows
+    if (improved) {
+        std::cout << "info depth " << depth << " score ";
+        if (std::abs(score) >= MATE - 1000) std::cout << "mate " << (score > 0 ? 1 : -1) * ((MATE - std::abs(score) + 1) / 2);
+        else std::cout << "cp " << score;
+        std::cout << " nodes " << searchStats.nodes() + clusterNodes << " pv " << moveToString(bestMove) << "\n";
+    }
+    return score;
+}
+
+// Serve a master until it disconnects
+void clusterWorker(const std::string& host, const std::string& port, const std::string& secret) {
+    addrinfo hints, *res = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    int fd = -1;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) == 0) {
+        fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+    }
+    if (fd < 0) {
+        std::cout << "info string cluster: cannot connect to " << host << ":" << port << "\n";
+        return;
+    }
+    
+    clusterMaster = newLink(fd);
+    sendLine(clusterMaster, "hello " + secret);
+    
+    // Entries are taken in as they arrive, even mid-search; commands queue
+    std::deque<std::string> commands;
+    std::mutex queueLock;
+    std::condition_variable queued;
+    bool closed = false;
+    std::thread reader([&] {
+        std::string buffer, line;
+        while (readLine(fd, buffer, line)) {
+            if (line.compare(0, 3, "tt ") == 0) {
+                std::istringstream iss(line.substr(3));
+                receiveEntries(iss);
+                continue;
+            }
+            std::lock_guard<std::mutex> guard(queueLock);
+            commands.push_back(line);
+            queued.notify_one();
+        }
+        std::lock_guard<std::mutex> guard(queueLock);
+        closed = true;
+        queued.notify_one();
+    });
+    
+    Board b;
+    while (true) {
+        std::string line;
+        {
+            std::unique_lock<std::mutex> guard(queueLock);
+            queued.wait(guard, [&] { return closed || !commands.empty(); });
+            if (commands.empty()) break;
+            line = commands.front();
+            commands.pop_front();
+        }
+        std::istringstream iss(line);
+        std::string cmd;
+        iss >> cmd;
+        if (cmd == "position") {
+            std::string fen;
+            std::getline(iss, fen);
+            b.setFen(fen);
+        } else if (cmd == "newgame") {
+            newGame();
+        } else if (cmd == "search") {
+            int depth, timeLimit, nodesPerMs, packed;
+            iss >> depth >> timeLimit >> nodesPerMs;
+            while (iss >> packed) rootMoves.push_back(unpackMove(packed));
+            Move bestMove;
+            clockNodesPerMs = nodesPerMs;
+            startPump();
+            int score = thinkLocal(b, depth, bestMove, timeLimit);
+            stopPump();
+            clockNodesPerMs = 0;
+            rootMoves.clear();
+            sendLine(clusterMaster, "result " + std::to_string(packMove(bestMove)) + " " + std::to_string(score) + " " +
+                     std::to_string(searchStats.currentDepth) + " " +
+                     std::to_string(searchStats.nodes() + searchStats.qnodes()));
+        }
+    }
+    reader.join();
+    close(fd);
+    delete clusterMaster;
+    clusterMaster = nullptr;
+}
+#else
+void clusterClose() {}
+bool clusterListen(int port) { return port == 0; }
+int clusterThink(Board& b, int maxDepth, Move& bestMove, int timeLimit) { return thinkLocal(b, maxDepth, bestMove, timeLimit); }
+void clusterWorker(const std::string&, const std::string&, const std::string&) {
+    std::cout << "info string cluster search is not available on this platform\n";
+}
+#endif
+
+int think(Board& b, int maxDepth, Move& bestMove, int timeLimit = 0) {
+    if (clusterLinks.empty()) return thinkLocal(b, maxDepth, bestMove, timeLimit);
+    return clusterThink(b, maxDepth, bestMove, timeLimit);
+}
+
+// Forget everything learned: TT plus every thread's history and killers
+void newGame() {
+    historyTable.init();
+    killerMoves.init();
+    l1Clear();
+    correctionHistory.init();
+    threadPool.run([](int) { historyTable.init(); killerMoves.init(); correctionHistory.init(); l1Clear(); });
+    threadPool.wait();
+    ttClear();
+#ifndef _WIN32
+    std::lock_guard<std::mutex> guard(clusterLock);
+    for (ClusterLink* link : clusterLinks)
+        if (link->alive) sendLine(link, "newgame");
+#endif
+}
+
+// Bench: fixed-depth searches over a position set. The total node count
+// is a signature of the search; time and nodes compare thread counts.
+const char* benchPositions[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "r1bq1rk1/pp2bppp/2n2n2/3p4/3P4/2NBBN2/PP3PPP/R2QK2R w KQ - 0 10",
+    "2r3k1/pp3pp1/4p2p/3pP3/3P4/P4N2/1P3PPP/2R3K1 w - - 0 20"
+};
+
+// Depth-first proof-number search (df-pn) for forced mates, "go mate N".
+// The attacker only tries checking moves and the defender every evasion.
+// Proof and disproof numbers are kept as (phi, delta) from the side to
+// move: phi = 0 means the side to move wins (the attacker mates, or the
+// defender escapes the ply limit). Results live in the solver's own table,
+// keyed by position and remaining plies.
+struct MateSolver {
+    struct Entry {
+        U64 key;
+        uint32_t phi, delta;
+    };
+    
+    static const uint32_t INFINITE = 1u << 30;
+    static const int TABLE_BITS = 20;
+    static const long long NODE_LIMIT = 50000000; // Without a time budget
+    
+    std::vector<Entry> table;
+    long long nodes, nodeLimit;
+    int timeLimit; // Milliseconds, 0 for none
+    std::chrono::steady_clock::time_point start;
+    bool aborted;
+    
+    MateSolver() : table(1 << TABLE_BITS), nodes(0), nodeLimit(NODE_LIMIT), timeLimit(0), aborted(false) {}
+    
+    // Start a new search; the table is reused, not reallocated
+    void reset(long long maxNodes, int maxMs) {
+        std::fill(table.begin(), table.end(), Entry());
+        nodes = 0;
+        nodeLimit = maxNodes;
+        timeLimit = maxMs;
+        start = std::chrono::steady_clock::now();
+        aborted = false;
+    }
+    
+    long long elapsedMs() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    
+    static U64 key(U64 hash, int plies) {
+        return hash ^ ((U64)(plies + 1) * 0x9E3779B97F4A7C15ULL);
+    }
+    
+    void lookup(U64 hash, int plies, uint32_t& phi, uint32_t& delta) const {
+        U64 k = key(hash, plies);
+        const Entry& e = table[k & ((1 << TABLE_BITS) - 1)];
+        if (e.key == k) {
+            phi = e.phi;
+            delta = e.delta;
+        } else {
+            phi = delta = 1;
+        }
+    }
+    
+    void store(U64 hash, int plies, uint32_t phi, uint32_t delta) {
+        U64 k = key(hash, plies);
+        Entry& e = table[k & ((1 << TABLE_BITS) - 1)];
+        e.key = k;
+        e.phi = phi;
+        e.delta = delta;
+    }
+    
+    // Odd plies left: the attacker moves, checks only
+    std::vector<Move> children(Board& b, int plies) {
+        std::vector<Move> moves = generateMoves(b);
+        if (plies & 1) {
+            moves.erase(std::remove_if(moves.begin(), moves.end(),
+                                       [&](const Move& m) { return !givesCheck(b, m); }), moves.end());
+        }
+        return moves;
+    }
+    
+    // Expand a node until its numbers reach either threshold
+    void mid(Board& b, int plies, uint32_t thPhi, uint32_t thDelta) {
+        if (++nodes > nodeLimit) aborted = true;
+        if ((nodes & 1023) == 0 && (pendingStops.load() || (timeLimit && elapsedMs() >= timeLimit))) aborted = true;
+        if (aborted) return;
+        
+        std::vector<Move> moves = children(b, plies);
+        if (moves.empty() || plies == 0) {
+            // No checks, mated, or the defender survived the last ply
+            bool moverWins = plies % 2 == 0 && !(moves.empty() && isInCheck(b));
+            if (moverWins) store(b.hash, plies, 0, INFINITE);
+            else store(b.hash, plies, INFINITE, 0);
+            return;
+        }
+        
+        std::vector<U64> hashes(moves.size());
+        for (size_t i = 0; i < moves.size(); i++) {
+            Board copy = b;
+            makeMove(copy, moves[i]);
+            hashes[i] = copy.hash;
+        }
+        
+        while (true) {
+            uint32_t phi = INFINITE, bestPhi = 0, secondDelta = INFINITE;
+            U64 delta = 0;
+            int best = -1;
+            for (size_t i = 0; i < moves.size(); i++) {
+                uint32_t cPhi, cDelta;
+                lookup(hashes[i], plies - 1, cPhi, cDelta);
+                delta += cPhi;
+                if (cDelta < phi) {
+                    secondDelta = phi;
+                    phi = cDelta;
+                    bestPhi = cPhi;
+                    best = (int)i;
+                } else if (cDelta < secondDelta) {
+                    secondDelta = cDelta;
+                }
+            }
+            delta = std::min<U64>(delta, INFINITE);
+            
+            if (phi >= thPhi || delta >= thDelta || aborted) {
+                store(b.hash, plies, phi, (uint32_t)delta);
+                return;
+            }
+            
+            // The best child gets the budget left by its siblings
+            uint32_t childPhi = (uint32_t)std::min<U64>(INFINITE, thDelta + bestPhi - delta);
+            uint32_t childDelta = std::min(thPhi, secondDelta + 1);
+            Board copy = b;
+            makeMove(copy, moves[best]);
+            mid(copy, plies - 1, childPhi, childDelta);
+        }
+    }
+    
+    // Does the side to move win within 'plies'? Unknown if aborted.
+    bool solve(Board& b, int plies) {
+        uint32_t phi, delta;
+        lookup(b.hash, plies, phi, delta);
+        if (phi != 0 && delta != 0) {
+            mid(b, plies, INFINITE, INFINITE);
+            lookup(b.hash, plies, phi, delta);
+        }
+        return phi == 0;
+    }
+    
+    // Fewest attacker moves (up to 'limit') that mate, or 0
+    int mateLength(Board& b, int limit) {
+        for (int n = 1; n <= limit && !aborted; n++)
+            if (solve(b, 2 * n - 1)) return n;
+        return 0;
+    }
+    
+    // Mating line: the attacker takes the quickest mate, the defender the
+    // longest resistance
+    void principalVariation(Board b, int n, std::vector<Move>& pv) {
+        while (n > 0 && !aborted) {
+            Move chosen;
+            for (const Move& m : children(b, 1)) {
+                Board copy = b;
+                makeMove(copy, m);
+                if (!solve(copy, 2 * n - 2)) {
+                    chosen = m;
+                    break;
+                }
+            }
+            pv.push_back(chosen);
+            makeMove(b, chosen);
+            if (--n == 0) break;
+            
+            int longest = -1;
+            for (const Move& m : generateMoves(b)) {
+                Board copy = b;
+                makeMove(copy, m);
+                int length = mateLength(copy, n);
+                if (length > longest) {
+                    longest = length;
+                    chosen = m;
+                }
+            }
+            if (longest <= 0) break;
+            pv.push_back(chosen);
+            makeMove(b, chosen);
+            n = longest;
+        }
+    }
+};
+
+// go mate N: true and the mating move if a mate in N or fewer was proven.
+// budgetMs bounds the solver (in nodes when the clock runs on nodes, see
+// nodestime); 0 leaves only the fixed node limit. A queued stop ends it.
+// spentMs is what the solver took from the clock.
+MateSolver* mateSolver = nullptr; // Allocated by the first go mate, then kept
+
+bool mateSearch(Board& b, int maxMoves, Move& bestMove, int budgetMs, int& spentMs) {
+    if (!mateSolver) mateSolver = new MateSolver();
+    MateSolver& solver = *mateSolver;
+    if (!budgetMs) solver.reset(MateSolver::NODE_LIMIT, 0);
+    else if (clockNodesPerMs) solver.reset((long long)budgetMs * clockNodesPerMs, 0);
+    else solver.reset(MateSolver::NODE_LIMIT, budgetMs);
+    
+    int n = solver.mateLength(b, maxMoves);
+    std::vector<Move> pv;
+    if (n) solver.principalVariation(b, n, pv);
+    long long ms = solver.elapsedMs();
+    spentMs = (int)(clockNodesPerMs ? solver.nodes / clockNodesPerMs : ms);
+    
+    if (n && !pv.empty()) {
+        std::cout << "info depth " << 2 * n - 1 << " score mate " << n << " nodes " << solver.nodes
+                  << " nps " << (ms ? solver.nodes * 1000 / ms : 0) << " time " << ms << " pv";
+        for (const Move& m : pv) std::cout << " " << moveToString(m);
+        std::cout << "\n";
+        bestMove = pv[0];
+    } else {
+        const char* reason = pendingStops.load() ? " (stopped)" : budgetMs ? " (out of time)" : " (node limit)";
+        std::cout << "info string no mate in " << maxMoves << (solver.aborted ? std::string(" proven") + reason : "")
+                  << " nodes " << solver.nodes << " time " << ms << "\n";
+    }
+    return n && !pv.empty();
+}
+
+// Base for heap objects holding Boards: plain new only honours the 64-byte
+// alignment from C++17 on
+struct CacheAligned {
+    static void* operator new(size_t size) {
+        void* p = nullptr;
+#ifdef _WIN32
+        p = _aligned_malloc(size, 64);
+#else
+        if (posix_memalign(&p, 64, size)) p = nullptr;
+#endif
+        if (!p) throw std::bad_alloc();
+        return p;
+    }
+    static void operator delete(void* p) {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+};
+
+// Resumable search: search() with its recursion unrolled onto an explicit
+// stack of frames, so it can stop after any node and continue later, on
+// any thread. Each frame keeps a resume point saying where its node left
+// off. Quiescence stays recursive; it is shallow and bounded. The node
+// order is exactly that of iterativeDeepening on one thread.
+struct ResumableSearch : CacheAligned {
+    enum { ENTER, NULL_MOVE_DONE, NEXT_MOVE, CHILD_DONE }; // Resume points
+    
+    struct Frame : CacheAligned {
+        Board b;
+        int depth, alpha, beta, ply;
+        int rawEval, staticEval, origAlpha, bestScore, moveCount, reduction;
+        int resume, pass; // pass: the PASS_ child search a move is waiting for
+        bool nullMove, inCheck, hasPicker;
+        Move ttMove, localBest, current;
+        alignas(MovePicker) unsigned char pickerStorage[sizeof(MovePicker)];
+        
+        MovePicker& picker() { return *reinterpret_cast<MovePicker*>(pickerStorage); }
+        
+    };
+    
+    std::vector<Frame*> frames; // Grown on demand, reused between iterations
+    int top;                    // Innermost live frame, -1 between root searches
+    int childScore;             // Result of the frame just finished, for its parent
+    
+    Board root;
+    int maxDepth, depth, score, alpha, beta, window;
+    bool researching, done;
+    Move bestMove, rootBest;
+    long long nodes;
+    
+    ResumableSearch(const Board& b, int maxD)
+        : top(-1), childScore(0), root(b), maxDepth(maxD), depth(1), score(0), alpha(-INF), beta(INF),
+          window(params->aspirationWindow), researching(false), done(false), nodes(0) {}
+    
+    ~ResumableSearch() {
+        while (top >= 0) pop();
+        for (Frame* f : frames) delete f;
+    }
+    
+    // Search until finished or about budget more nodes; true when finished
+    bool run(long long budget) {
+        long long stop = nodes + budget;
+        while (!done && nodes < stop) step();
+        return done;
+    }
+    
+    void push(const Board& b, int d, int a, int be, int ply, bool nullMove) {
+        if (++top == (int)frames.size()) frames.push_back(new Frame());
+        Frame& f = *frames[top];
+        f.b = b;
+        f.depth = d;
+        f.alpha = a;
+        f.beta = be;
+        f.ply = ply;
+        f.nullMove = nullMove;
+        f.hasPicker = false;
+        f.resume = ENTER;
+    }
+    
+    void pop() {
+        Frame& f = *frames[top];
+        if (f.hasPicker) f.picker().~MovePicker();
+        f.hasPicker = false;
+        top--;
+    }
+    
+    // Leave the current node with a score for its parent
+    void finish(int value) {
+        pop();
+        if (top >= 0) childScore = value;
+        else rootDone(value);
+    }
+    
+    void step() {
+        if (top < 0) {
+            startIteration();
+            return;
+        }
+        Frame& f = *frames[top];
+        switch (f.resume) {
+            case ENTER: enter(f); break;
+            case NULL_MOVE_DONE:
+                if (-childScore >= f.beta) finish(f.beta); // Null move cutoff
+                else startMoves(f);
+                break;
+            case NEXT_MOVE: nextMove(f); break;
+            case CHILD_DONE: childDone(f); break;
+        }
+    }
+    
+    // Aspiration windows as in iterativeDeepening
+    void startIteration() {
+        if (researching) {
+            push(root, depth, -INF, INF, 0, true);
+            return;
+        }
+        if (depth >= 4) {
+            alpha = score - window;
+            beta = score + window;
+        }
+        push(root, depth, alpha, beta, 0, true);
+    }
+    
+    void rootDone(int value) {
+        if (!researching && (value <= alpha || value >= beta)) {
+            researching = true; // Re-search with a full window
+            window = params->aspirationWindow;
+            return;
+        }
+        if (!researching) window = params->aspirationNarrow;
+        researching = false;
+        score = value;
+        bestMove = rootBest;
+        if (std::abs(score) >= MATE - 1000 || depth == maxDepth) done = true;
+        else depth++;
+    }
+    
+    void enter(Frame& f) {
+        nodes++;
+        localStats->nodes.inc();
+        localStats->seldepth.max(f.ply);
+        
+        f.inCheck = isInCheck(f.b);
+        if (f.inCheck) f.depth++;
+        
+        TTData tt;
+        bool ttHit = ttProbe(f.b.hash, tt, f.depth);
+        if (ttHit) localStats->ttHits.inc();
+        
+        int ttScore;
+        if (ttHit && ttCutoff(tt, f.depth, f.alpha, f.beta, ttScore)) {
+            if (f.ply == 0 && tt.flag == TT_EXACT) rootBest = unpackMove(tt.bestMove);
+            return finish(ttScore);
+        }
+        f.ttMove = ttHit && tt.bestMove ? unpackMove(tt.bestMove) : Move();
+        
+        if (f.depth <= 0) return finish(quiescence(f.b, f.alpha, f.beta, 0, f.ply));
+        
+        f.rawEval = f.staticEval = -INF;
+        
+        Board child;
+        int childDepth;
+        if (nullMoveChild(f.b, f.depth, f.ply, f.nullMove, f.inCheck, child, childDepth)) {
+            f.resume = NULL_MOVE_DONE;
+            push(child, childDepth, -f.beta, -f.beta + 1, f.ply + 1, false);
+            return;
+        }
+        startMoves(f);
+    }
+    
+    void startMoves(Frame& f) {
+        new (f.pickerStorage) MovePicker(f.b, f.ttMove, f.ply);
+        f.hasPicker = true;
+        f.moveCount = 0;
+        f.bestScore = -INF;
+        f.localBest = Move();
+        f.origAlpha = f.alpha;
+        f.resume = NEXT_MOVE;
+    }
+    
+    // Pick the next move and start its first child search (searchMove)
+    void nextMove(Frame& f) {
+        Move m;
+        if (!f.picker().next(m)) return endNode(f);
+        f.moveCount++;
+        bool checks = givesCheck(f.b, m);
+        if (f.ply == 0 && f.moveCount == 1) rootBest = m;
+        
+        if (futile(f.b, m, f.depth, f.alpha, f.moveCount, f.inCheck, checks, f.rawEval, f.staticEval)) return;
+        
+        f.reduction = lmrReduction(f.b, m, f.depth, f.ply, f.moveCount, f.inCheck, checks);
+        f.current = m;
+        f.resume = CHILD_DONE;
+        f.pass = f.moveCount == 1 ? PASS_FIRST : PASS_NULL_WINDOW;
+        searchChild(f, f.depth - 1 - f.reduction, f.pass == PASS_FIRST ? -f.beta : -f.alpha - 1, -f.alpha);
+    }
+    
+    void searchChild(Frame& f, int d, int a, int be) {
+        Board copy = f.b;
+        makeMove(copy, f.current);
+        push(copy, d, a, be, f.ply + 1, true);
+    }
+    
+    // A child search returned: re-search as searchMove would, or take the score
+    void childDone(Frame& f) {
+        int value = -childScore;
+        f.pass = nextPass(f.pass, value, f.alpha, f.beta, f.reduction);
+        if (f.pass != PASS_DONE) return searchChild(f, f.depth - 1, -f.beta, -f.alpha);
+        
+        f.resume = NEXT_MOVE;
+        if (f.ply == 0 && value > f.bestScore) rootBest = f.current;
+        if (recordScore(f.b, f.current, value, f.depth, f.ply, f.alpha, f.beta, f.bestScore, f.localBest)) endNode(f);
+    }
+    
+    void endNode(Frame& f) {
+        if (f.moveCount == 0) return finish(f.inCheck ? -MATE + f.ply : 0);
+        storeNode(f.b, f.depth, f.bestScore, f.origAlpha, f.beta, f.localBest, f.inCheck, false, f.rawEval, f.staticEval);
+        finish(f.bestScore);
+    }
+};
+
+// Background analysis of many positions: the pool's threads round-robin
+// resumable searches, each getting slice nodes at a time, so no search
+// holds a thread for longer than one slice however deep it goes.
+void batch(const std::string& path, int depth, long long slice) {
+    std::ifstream in(path);
+    std::vector<std::string> fens;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.find_first_not_of(" \t\r") != std::string::npos) fens.push_back(line);
+    }
+    if (fens.empty()) {
+        std::cout << "info string no positions in " << path << "\n";
+        return;
+    }
+    
+    std::mutex lock;
+    std::deque<std::pair<int, ResumableSearch*>> ready;
+    size_t next = 0;
+    int live = 0, maxLive = 4 * threadPool.size; // Searches started and not yet finished
+    long long slices = 0, sliceUsSum = 0, sliceUsMax = 0, totalNodes = 0;
+    auto start = std::chrono::steady_clock::now();
+    
+    runOnPool([&](int, int) {
+        while (true) {
+            std::pair<int, ResumableSearch*> task(0, nullptr);
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (next < fens.size() && (live < maxLive || ready.empty())) {
+                    Board b;
+                    b.setFen(fens[next]);
+                    task = std::make_pair((int)next++, new ResumableSearch(b, depth));
+                    live++;
+                } else if (!ready.empty()) {
+                    task = ready.front();
+                    ready.pop_front();
+                } else {
+                    break; // Whatever is left is being searched by other threads
+                }
+            }
+            
+            auto sliceStart = std::chrono::steady_clock::now();
+            bool finished = task.second->run(slice);
+            long long us = microsSince(sliceStart);
+            
+            std::lock_guard<std::mutex> guard(lock);
+            slices++;
+            sliceUsSum += us;
+            sliceUsMax = std::max(sliceUsMax, us);
+            if (!finished) {
+                ready.push_back(task);
+                continue;
+            }
+            ResumableSearch* s = task.second;
+            std::cout << "batch " << task.first + 1 << " depth " << s->depth << " score cp " << s->score
+                      << " nodes " << s->nodes << " bestmove " << moveToString(s->bestMove) << "\n";
+            totalNodes += s->nodes;
+            live--;
+            delete s;
+        }
+    });
+    
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "info string batch " << fens.size() << " positions nodes " << totalNodes << " time " << ms
+              << " ms slices " << slices << " slice avg " << sliceUsSum / std::max(1LL, slices)
+              << " us max " << sliceUsMax << " us\n";
+}
+
+// One side of an spsa game: its parameters and the search state it
+// builds up. The state is loaded into the thread's tables for the side's
+// own moves and saved back after, so neither side searches with what the
+// other learned; its TT overlay keeps its entries out of the shared
+// table, which stays empty, and so away from games on other threads.
+struct SpsaSide {
+    const SearchParams* params;
+    HistoryTable history;
+    KillerMoves killers;
+    CorrectionHistory correction;
+    TTOverlay tt;
+    
+    void init(const SearchParams* p) {
+        params = p;
+        history.init();
+        killers.init();
+        correction.init();
+        tt.clear();
+    }
+};
+
+// Self-play for spsa. Both sides search with ResumableSearch for a fixed
+// node budget on the calling thread, each with its own parameters and
+// state, fresh for every game. Games end by mate, stalemate, threefold
+// repetition, the fifty-move rule, a score beyond 1000 for both sides
+// four plies running, or after 300 plies.
+// Returns the result for white: 1, 0.5 or 0.
+double playGame(const Board& start, SpsaSide& white, SpsaSide& black, long long nodes) {
+    Board b = start;
+    std::vector<U64> seen(1, b.hash);
+    int decisive = 0; // Plies in a row with a decisive score for the same side
+    double decisiveResult = 0.5;
+    
+    for (int ply = 0; ply < 300; ply++) {
+        auto moves = generateMoves(b);
+        if (moves.empty()) return isInCheck(b) ? (b.side == WHITE ? 0 : 1) : 0.5;
+        if (b.rule50 >= 100 || std::count(seen.begin(), seen.end(), b.hash) >= 3) return 0.5;
+        
+        SpsaSide& side = b.side == WHITE ? white : black;
+        params = side.params;
+        historyTable = side.history;
+        killerMoves = side.killers;
+        correctionHistory = side.correction;
+        ttOverlay = &side.tt;
+        ResumableSearch* s = new ResumableSearch(b, 30);
+        s->run(nodes);
+        side.history = historyTable;
+        side.killers = killerMoves;
+        side.correction = correctionHistory;
+        ttOverlay = nullptr;
+        Move m = s->bestMove.from != s->bestMove.to ? s->bestMove : moves[0];
+        double result = (s->score > 0) == (b.side == WHITE) ? 1 : 0;
+        if (std::abs(s->score) < 1000 || s->bestMove.from == s->bestMove.to) decisive = 0;
+        else decisive = decisive && result == decisiveResult ? decisive + 1 : 1;
+        decisiveResult = result;
+        delete s;
+        if (decisive >= 4) return result;
+        
+        makeMove(b, m);
+        seen.push_back(b.hash);
+    }
+    return 0.5;
+}
+
+// SPSA tuning of searchParams. Each iteration perturbs every parameter by
+// +-c_k at random and plays a game pair from the same opening between the
+// two perturbed sets; the parameters move along the perturbation by how
+// much the plus side scored. The pool's threads play pairs in parallel,
+// each updating the shared estimate when its pair ends; games share no
+// search state (see SpsaSide), and L1 tables are detached for the run.
+// Progress goes to path every 100 pairs and a run with the same file
+// resumes from there.
+void spsa(int pairs, long long nodes, const std::string& path) {
+    const double ALPHA = 0.602, GAMMA = 0.101, LEARNING = 0.2;
+    const double A = pairs / 10.0;
+    int openings = sizeof(benchPositions) / sizeof(benchPositions[0]);
+    
+    double theta[PARAM_COUNT];
+    for (int i = 0; i < PARAM_COUNT; i++) theta[i] = searchParams.*paramSpecs[i].field;
+    int started = 0, finished = 0, resumed;
+    std::ifstream in(path);
+    std::string name;
+    double value;
+    while (in >> name >> value) {
+        if (name == "iteration") started = finished = (int)value;
+        for (int i = 0; i < PARAM_COUNT; i++)
+            if (name == paramSpecs[i].name) theta[i] = value;
+    }
+    resumed = started;
+    if (started) std::cout << "info string spsa resuming " << path << " at pair " << started << "\n";
+    
+    auto save = [&]() {
+        std::ofstream out(path);
+        out << "iteration " << finished << "\n";
+        for (int i = 0; i < PARAM_COUNT; i++) out << paramSpecs[i].name << " " << theta[i] << "\n";
+    };
+    
+    std::mutex lock;
+    double plusScore = 0;
+    ttClear();
+    auto start = std::chrono::steady_clock::now();
+    
+    runOnPool([&](int, int) {
+        TTEntry* l1 = l1Table;
+        l1Table = nullptr;
+        std::vector<SpsaSide> sides(2);
+        SearchParams plus, minus;
+        double delta[PARAM_COUNT], c[PARAM_COUNT];
+        
+        while (true) {
+            int k;
+            Board opening;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (started >= pairs) break;
+                k = ++started;
+                std::mt19937 rng(k);
+                for (int i = 0; i < PARAM_COUNT; i++) {
+                    const ParamSpec& spec = paramSpecs[i];
+                    delta[i] = rng() & 1 ? 1 : -1;
+                    c[i] = spec.step / std::pow(k, GAMMA);
+                    // Rounded with at least one unit of difference between the sides
+                    int up = (int)std::lround(theta[i] + c[i] * delta[i]);
+                    int down = (int)std::lround(theta[i] - c[i] * delta[i]);
+                    if (up == down) up += (int)delta[i];
+                    plus.*spec.field = std::max(spec.min, std::min(spec.max, up));
+                    minus.*spec.field = std::max(spec.min, std::min(spec.max, down));
+                }
+                
+                // A bench position with two random plies, so pairs see varied openings
+                opening.setFen(benchPositions[rng() % openings]);
+                for (int ply = 0; ply < 2; ply++) {
+                    auto moves = generateMoves(opening);
+                    if (moves.empty()) break;
+                    makeMove(opening, moves[rng() % moves.size()]);
+                }
+            }
+            
+            sides[0].init(&plus);
+            sides[1].init(&minus);
+            double score = playGame(opening, sides[0], sides[1], nodes);
+            sides[0].init(&plus);
+            sides[1].init(&minus);
+            score += 1 - playGame(opening, sides[1], sides[0], nodes);
+            
+            std::lock_guard<std::mutex> guard(lock);
+            plusScore += score;
+            double a = LEARNING * std::pow((A + 1) / (A + k), ALPHA);
+            for (int i = 0; i < PARAM_COUNT; i++) {
+                const ParamSpec& spec = paramSpecs[i];
+                theta[i] += a * spec.step * spec.step / c[i] * (score - 1) * delta[i];
+                theta[i] = std::max<double>(spec.min, std::min<double>(spec.max, theta[i]));
+            }
+            finished++;
+            if (finished % 100 == 0 || finished == pairs) {
+                save();
+                std::cout << "info string spsa pair " << finished << "/" << pairs << " plus score "
+                          << plusScore / 2 / (finished - resumed) << " time " << microsSince(start) / 1000000 << " s";
+                for (int i = 0; i < PARAM_COUNT; i++) std::cout << " " << paramSpecs[i].name << " " << theta[i];
+                std::cout << "\n";
+            }
+        }
+        params = &searchParams;
+        l1Table = l1;
+    });
+    
+    save();
+    for (int i = 0; i < PARAM_COUNT; i++) {
+        searchParams.*paramSpecs[i].field = (int)std::lround(theta[i]);
+        std::cout << "setoption name " << paramSpecs[i].name << " value " << searchParams.*paramSpecs[i].field << "\n";
+    }
+    newGame();
+}
+
+// Count leaf nodes of the legal move tree (move generator speed and check)
+U64 perft(Board& b, int depth) {
+    std::vector<Move> moves = generateMoves(b);
+    if (depth <= 1) return moves.size();
+    U64 nodes = 0;
+    for (const Move& m : moves) {
+        Board copy = b;
+        makeMove(copy, m);
+        nodes += perft(copy, depth - 1);
+    }
+    return nodes;
+}
+
+void runPerft(Board& b, int depth) {
+    auto start = std::chrono::steady_clock::now();
+    U64 nodes = perft(b, depth);
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Nodes: " << nodes << " time " << ms << " ms nps " << (ms ? nodes * 1000 / ms : 0) << "\n";
+}
+
+void bench(int depth) {
+    int count = sizeof(benchPositions) / sizeof(benchPositions[0]);
+    long long totalNodes = 0, totalSplits = 0, totalJoins = 0;
+    auto start = std::chrono::steady_clock::now();
+    
+    for (int i = 0; i < count; i++) {
+        Board b;
+        b.setFen(benchPositions[i]);
+        newGame();
+        
+        std::cout << "\nPosition " << i + 1 << "/" << count << ": " << benchPositions[i] << "\n";
+        Move bestMove;
+        think(b, depth, bestMove);
+        totalNodes += searchStats.nodes() + searchStats.qnodes();
+        if (!clusterLinks.empty()) totalNodes += clusterNodes;
+        totalSplits += splitCount;
+        totalJoins += joinCount;
+    }
+    
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+    std::cout << "\n===========================\n";
+    std::cout << "Threads         : " << uciOptions.threads << "\n";
+    if (!clusterLinks.empty()) std::cout << "Cluster nodes   : " << clusterLinks.size() + 1 << "\n";
+    std::cout << "Total time (ms) : " << ms << "\n";
+    std::cout << "Nodes searched  : " << totalNodes << "\n";
+    std::cout << "Nodes/second    : " << (ms ? totalNodes * 1000 / ms : 0) << "\n";
+    if (uciOptions.threads > 1) {
+        std::cout << "Split points    : " << totalSplits << "\n";
+        std::cout << "Helper joins    : " << totalJoins << "\n";
+    }
+}
+
+// Initialize lookup tables
+void initTables() {
+    for (int sq = 0; sq < 64; sq++) {
+        int x = sq % 8, y = sq / 8;
+        
+        KingMoves[sq] = 0;
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                if (dx == 0 && dy == 0) continue;
+                int nx = x + dx, ny = y + dy;
+                if (nx >= 0 && nx < 8 && ny >= 0 && ny < 8) {
+                    KingMoves[sq] |= 1ULL << (ny * 8 + nx);
+                }
+            }
+        }
+        
+        KnightMoves[sq] = 0;
+        int kdx[] = {2, 2, -2, -2, 1, 1, -1, -1};
+        int kdy[] = {1, -1, 1, -1, 2, -2, 2, -2};
+        for (int i = 0; i < 8; i++) {
+            int nx = x + kdx[i], ny = y + kdy[i];
+            if (nx >= 0 && nx < 8 && ny >= 0 && ny < 8) {
+                KnightMoves[sq] |= 1ULL << (ny * 8 + nx);
+            }
+        }
+        
+        PawnAttacks[WHITE][sq] = PawnAttacks[BLACK][sq] = 0;
+        if (x > 0 && y < 7) PawnAttacks[WHITE][sq] |= 1ULL << (sq + 7);
+        if (x < 7 && y < 7) PawnAttacks[WHITE][sq] |= 1ULL << (sq + 9);
+        if (x > 0 && y > 0) PawnAttacks[BLACK][sq] |= 1ULL << (sq - 9);
+        if (x < 7 && y > 0) PawnAttacks[BLACK][sq] |= 1ULL << (sq - 7);
+        
+        RookRays[sq] = get_rook_attacks(sq, 0);
+        BishopRays[sq] = get_bishop_attacks(sq, 0);
+    }
+    
+    // Squares between and lines through aligned square pairs
+    for (int a = 0; a < 64; a++) {
+        for (int b = 0; b < 64; b++) {
+            U64 a_bb = 1ULL << a, b_bb = 1ULL << b;
+            Between[a][b] = Line[a][b] = 0;
+            if (a == b) continue;
+            if (RookRays[a] & b_bb) {
+                Between[a][b] = get_rook_attacks(a, b_bb) & get_rook_attacks(b, a_bb);
+                Line[a][b] = (RookRays[a] & RookRays[b]) | a_bb | b_bb;
+            } else if (BishopRays[a] & b_bb) {
+                Between[a][b] = get_bishop_attacks(a, b_bb) & get_bishop_attacks(b, a_bb);
+                Line[a][b] = (BishopRays[a] & BishopRays[b]) | a_bb | b_bb;
+            }
+        }
+    }
+    
+    initZobrist();
+    for (int i = 0; i < MAX_THREADS; i++) {
+        searchThreads[i].index = i;
+    }
+    historyTable.init();
+    killerMoves.init();
+}
+
+// Move parser for UCI
+bool parseMove(Board& b, std::string move_str, Move& parsed_move) {
+    auto moves = generateMoves(b);
+    int from = (move_str[0] - 'a') + (move_str[1] - '1') * 8;
+    int to = (move_str[2] - 'a') + (move_str[3] - '1') * 8;
+    int promo_piece = 0;
+
+    if (move_str.length() == 5) {
+        switch (move_str[4]) {
             case 'q': promo_piece = QUEEN; break;
             case 'r': promo_piece = ROOK; break;
             case 'b': promo_piece = BISHOP; break;
@@ -922,190 +3526,1352 @@ bool parseMove(Board& b, std::string move_str, Move& parsed_move) {
         }
     }
 
-    for (const auto& m : moves) {
-        if (m.from == from && m.to == to) {
-            if (m.promo) {
-                if (m.promo == promo_piece) {
-                    parsed_move = m;
-                    return true;
+    for (const auto& m : moves) {
+        if (m.from == from && m.to == to) {
+            if (m.promo) {
+                if (m.promo == promo_piece) {
+                    parsed_move = m;
+                    return true;
+                }
+            } else {
+                parsed_move = m;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Read a move in SAN (e4, Nbd7, exd5, e8=Q+, O-O-O); false if it is not legal here
+bool parseSan(Board& b, std::string san, Move& parsed_move) {
+    while (!san.empty() && strchr("+#!?", san.back())) san.pop_back();
+    auto moves = generateMoves(b);
+    
+    if (san == "O-O" || san == "0-0" || san == "O-O-O" || san == "0-0-0") {
+        int file = san.size() == 3 ? 6 : 2;
+        for (const auto& m : moves) {
+            if (m.piece == KING && std::abs(m.to - m.from) == 2 && m.to % 8 == file) {
+                parsed_move = m;
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    const char* pieces = "PNBRQK";
+    int piece = PAWN, promo = 0;
+    size_t start = 0;
+    if (!san.empty() && strchr("NBRQK", san[0])) piece = strchr(pieces, san[0]) - pieces, start = 1;
+    size_t eq = san.find('=');
+    if (eq != std::string::npos && eq + 1 < san.size() && strchr("NBRQ", san[eq + 1])) {
+        promo = strchr(pieces, san[eq + 1]) - pieces;
+        san.erase(eq);
+    } else if (piece == PAWN && !san.empty() && strchr("NBRQ", san.back())) {
+        promo = strchr(pieces, san.back()) - pieces;
+        san.pop_back();
+    }
+    if (san.size() < start + 2) return false;
+    
+    int to = (san[san.size() - 2] - 'a') + (san[san.size() - 1] - '1') * 8;
+    std::string from = san.substr(start, san.size() - 2 - start); // Disambiguation, maybe with 'x'
+    for (const auto& m : moves) {
+        if (m.piece != piece || m.to != to || m.promo != promo) continue;
+        bool matches = true;
+        for (char c : from) {
+            if (c >= 'a' && c <= 'h' && m.from % 8 != c - 'a') matches = false;
+            if (c >= '1' && c <= '8' && m.from / 8 != c - '1') matches = false;
+        }
+        if (matches) {
+            parsed_move = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Opening book builder. Games are streamed from the PGN and each move of
+// their first plies becomes a (position key, move, weight) record: 2 for
+// the winner's moves, 1 in draws or unfinished games, none for the loser.
+// Records are collected in a fixed buffer; a full buffer is sorted,
+// merged and written out as a run, and the runs are merged at the end,
+// so memory stays bounded however large the PGN is. The book is in the
+// engine's own format: 16-byte big-endian entries (key, move, weight,
+// learn) sorted by key, moves of a position by weight, laid out as
+// Polyglot's are, but keyed by this engine's Zobrist hashes. Those come
+// from the C library's rand(), so a book only matches builds on the same
+// platform, and Polyglot readers cannot use it; bookProbe reads it back.
+struct BookRecord {
+    U64 key;
+    uint32_t weight;
+    uint16_t move;
+    
+    bool operator<(const BookRecord& other) const {
+        return key != other.key ? key < other.key : move < other.move;
+    }
+};
+
+const size_t BOOK_BUFFER = 1 << 22; // Records per run (64 MB)
+
+// A move of one game, before it is weighted by the result
+struct BookMove {
+    U64 key;
+    uint16_t move;
+    int side; // Who played it: FEN games may start with black to move
+};
+
+// Book move: to file, to row, from file, from row, promotion piece in
+// 3 bits each; castling is written as the king taking its own rook
+uint16_t bookMove(const Move& m) {
+    int to = m.to;
+    if (m.piece == KING && m.to - m.from == 2) to = m.from + 3;
+    if (m.piece == KING && m.from - m.to == 2) to = m.from - 4;
+    return (uint16_t)(to % 8 | (to / 8) << 3 | (m.from % 8) << 6 | (m.from / 8) << 9 | m.promo << 12);
+}
+
+struct BookBuilder {
+    std::vector<BookRecord> buffer;
+    std::vector<std::string> runs;
+    std::string out;
+    int plies;
+    long long games, records;
+    
+    BookBuilder(const std::string& path, int maxPlies) : out(path), plies(maxPlies), games(0), records(0) {
+        buffer.reserve(BOOK_BUFFER);
+    }
+    
+    // Add the moves of one game; result is white's score in half points (-1: unknown)
+    void addGame(const std::vector<BookMove>& moves, int result) {
+        games++;
+        for (size_t i = 0; i < moves.size() && (int)i < plies; i++) {
+            int mover = moves[i].side == WHITE ? result : 2 - result;
+            BookRecord r = {moves[i].key, (uint32_t)(result < 0 ? 1 : mover), moves[i].move};
+            if (!r.weight) continue;
+            buffer.push_back(r);
+            records++;
+            if (buffer.size() == BOOK_BUFFER) flush();
+        }
+    }
+    
+    // Sort the buffer, merge equal records and write it as a run
+    void flush() {
+        if (buffer.empty()) return;
+        std::sort(buffer.begin(), buffer.end());
+        size_t n = 0;
+        for (size_t i = 0; i < buffer.size(); i++) {
+            if (n && buffer[n - 1].key == buffer[i].key && buffer[n - 1].move == buffer[i].move)
+                buffer[n - 1].weight += buffer[i].weight;
+            else
+                buffer[n++] = buffer[i];
+        }
+        runs.push_back(out + ".run" + std::to_string(runs.size()));
+        std::ofstream run(runs.back(), std::ios::binary);
+        run.write((const char*)buffer.data(), n * sizeof(BookRecord));
+        buffer.clear();
+    }
+    
+    static void putBE(std::ofstream& file, U64 value, int bytes) {
+        char data[8];
+        for (int i = 0; i < bytes; i++) data[i] = (char)(value >> (8 * (bytes - 1 - i)));
+        file.write(data, bytes);
+    }
+    
+    // Write the moves of one position, weights scaled to 16 bits
+    void writePosition(std::ofstream& file, std::vector<BookRecord>& moves) {
+        std::sort(moves.begin(), moves.end(), [](const BookRecord& a, const BookRecord& b) {
+            return a.weight > b.weight;
+        });
+        U64 scale = std::max<U64>(1, (moves[0].weight + 65534) / 65535);
+        for (const BookRecord& r : moves) {
+            if (r.weight / scale == 0) continue;
+            putBE(file, r.key, 8);
+            putBE(file, r.move, 2);
+            putBE(file, r.weight / scale, 2);
+            putBE(file, 0, 4);
+        }
+    }
+    
+    // Merge all runs into the book; returns the number of entries
+    long long finish() {
+        flush();
+        std::vector<std::ifstream> files;
+        typedef std::pair<BookRecord, size_t> Head;
+        auto later = [](const Head& a, const Head& b) { return b.first < a.first; };
+        std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+        for (size_t i = 0; i < runs.size(); i++) {
+            files.emplace_back(runs[i], std::ios::binary);
+            BookRecord r;
+            if (files[i].read((char*)&r, sizeof(r))) heads.push(Head(r, i));
+        }
+        
+        std::ofstream file(out, std::ios::binary);
+        std::vector<BookRecord> position;
+        long long entries = 0;
+        while (!heads.empty()) {
+            Head h = heads.top();
+            heads.pop();
+            BookRecord next;
+            if (files[h.second].read((char*)&next, sizeof(next))) heads.push(Head(next, h.second));
+            
+            if (!position.empty() && position[0].key != h.first.key) {
+                writePosition(file, position);
+                entries += position.size();
+                position.clear();
+            }
+            if (!position.empty() && position.back().move == h.first.move) position.back().weight += h.first.weight;
+            else position.push_back(h.first);
+        }
+        if (!position.empty()) {
+            writePosition(file, position);
+            entries += position.size();
+        }
+        files.clear();
+        for (const std::string& run : runs) std::remove(run.c_str());
+        return entries;
+    }
+};
+
+// PGN reader for makebook: tags, comments, variations, NAGs and move
+// numbers are skipped; a game whose move fails to parse keeps its earlier moves
+void makeBook(const std::string& pgn, const std::string& out, int plies) {
+    std::ifstream in(pgn);
+    if (!in) {
+        std::cout << "info string cannot open " << pgn << "\n";
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    BookBuilder builder(out, plies);
+    
+    Board b;
+    b.init();
+    std::vector<BookMove> moves;
+    int result = -1, variation = 0;
+    bool inComment = false, inGame = false, broken = false;
+    auto endGame = [&]() {
+        if (inGame) builder.addGame(moves, result);
+        moves.clear();
+        b.init();
+        result = -1;
+        inGame = broken = false;
+    };
+    
+    auto readToken = [&](const std::string& token) {
+        if (token == "1-0" || token == "0-1" || token == "1/2-1/2" || token == "*") {
+            if (result < 0) result = token == "1-0" ? 2 : token == "0-1" ? 0 : token == "1/2-1/2" ? 1 : -1;
+            inGame = true;
+            endGame();
+            return;
+        }
+        if (token[0] == '$') return; // NAG
+        
+        // Strip a move number ("12." or "12...") but not the zeros of 0-0
+        std::string san = token;
+        size_t number = san.find_first_not_of("0123456789");
+        if (number == std::string::npos) return;
+        if (san[number] == '.') san.erase(0, number);
+        san.erase(0, std::min(san.size(), san.find_first_not_of('.')));
+        if (san.empty()) return;
+        if (san.compare(0, 3, "0-0") == 0) std::replace(san.begin(), san.end(), '0', 'O');
+        
+        inGame = true;
+        Move m;
+        if (broken || (int)moves.size() >= plies) return;
+        if (parseSan(b, san, m)) {
+            moves.push_back({b.hash, bookMove(m), b.side});
+            makeMove(b, m);
+        } else {
+            broken = true;
+        }
+    };
+    
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!inComment && !line.empty() && line[0] == '[') {
+            if (inGame) endGame();
+            std::string tag, value;
+            size_t quote = line.find('"'), close = line.rfind('"');
+            tag = line.substr(1, line.find(' ') - 1);
+            if (quote != std::string::npos && close > quote) value = line.substr(quote + 1, close - quote - 1);
+            if (tag == "Result") result = value == "1-0" ? 2 : value == "0-1" ? 0 : value == "1/2-1/2" ? 1 : -1;
+            if (tag == "FEN") b.setFen(value);
+            continue;
+        }
+        
+        std::string token;
+        for (size_t i = 0; i <= line.size(); i++) {
+            char c = i < line.size() ? line[i] : ' ';
+            if (inComment) {
+                if (c == '}') inComment = false;
+                continue;
+            }
+            if (!isspace((unsigned char)c) && !strchr("{;()", c)) {
+                token += c;
+                continue;
+            }
+            if (!token.empty() && !variation) readToken(token);
+            token.clear();
+            if (c == '{') inComment = true;
+            else if (c == ';') break; // Comment to the end of the line
+            else if (c == '(') variation++;
+            else if (c == ')') variation = std::max(0, variation - 1);
+        }
+    }
+    endGame();
+    
+    long long entries = builder.finish();
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "info string makebook " << builder.games << " games " << builder.records << " records "
+              << entries << " entries " << builder.runs.size() << " runs time " << ms << " ms\n";
+}
+
+// Book lookup for go: binary search of the sorted entries for the
+// position's key, then a move picked in proportion to its weight (the
+// heaviest with Deterministic). Entries whose move is not legal here,
+// from a hash collision or a book of another build, are ignored.
+bool bookProbe(Board& b, Move& move) {
+    std::ifstream file(uciOptions.bookFile, std::ios::binary);
+    if (!file) return false;
+    file.seekg(0, std::ios::end);
+    long long count = (long long)file.tellg() / 16;
+    
+    auto readEntry = [&](long long i, U64& key, uint16_t& m, uint16_t& weight) {
+        unsigned char data[12];
+        file.seekg(i * 16);
+        file.read((char*)data, sizeof(data));
+        key = 0;
+        for (int j = 0; j < 8; j++) key = key << 8 | data[j];
+        m = (uint16_t)(data[8] << 8 | data[9]);
+        weight = (uint16_t)(data[10] << 8 | data[11]);
+    };
+    
+    U64 key;
+    uint16_t m, weight;
+    long long low = 0, high = count;
+    while (low < high) {
+        long long mid = (low + high) / 2;
+        readEntry(mid, key, m, weight);
+        if (key < b.hash) low = mid + 1;
+        else high = mid;
+    }
+    
+    std::vector<Move> legal = generateMoves(b);
+    std::vector<std::pair<Move, uint16_t>> candidates;
+    unsigned total = 0;
+    for (long long i = low; i < count; i++) {
+        readEntry(i, key, m, weight);
+        if (key != b.hash) break;
+        for (const Move& l : legal) {
+            if (bookMove(l) != m) continue;
+            candidates.push_back({l, weight});
+            total += weight;
+        }
+    }
+    if (candidates.empty() || !total) return false;
+    
+    // Entries of a position are sorted heaviest first
+    move = candidates[0].first;
+    if (uciOptions.deterministic) return true;
+    static std::mt19937 rng(std::random_device{}());
+    unsigned pick = rng() % total;
+    for (const auto& c : candidates) {
+        if (pick < c.second) {
+            move = c.first;
+            break;
+        }
+        pick -= c.second;
+    }
+    return true;
+}
+
+// Asynchronous stdout. std::cout is pointed at this streambuf, which
+// appends finished lines to a lock-free single-producer ring; a writer
+// thread drains it in batches, so a slow reader of the pipe never stalls
+// the search. Lines are produced by one thread at a time (the UCI thread,
+// or batch workers under their lock). If the ring is full, info lines are
+// dropped and counted; other lines wait for room. An optional debug log
+// records both directions as "ms > command" / "ms < output", which
+// replay reads back. Only the writer thread touches the log file.
+struct AsyncOutput : std::streambuf {
+    static const size_t RING_SIZE = 1 << 20;
+    
+    std::vector<char> ring;
+    std::atomic<size_t> head, tail; // Total bytes published and written
+    std::string line;               // Line being built by the producer
+    long long dropped;
+    std::atomic<bool> sleeping;     // Writer waits: producers take the lock only then
+    std::atomic<bool> logging;      // A log is open or being opened
+    std::mutex lock;                // Guards exiting, inputLog and logPath
+    std::condition_variable wake;
+    bool exiting, reopen;
+    std::string inputLog;           // Formatted input lines for the writer to log
+    std::string logPath;            // Log to open when reopen is set
+    std::thread writer;
+    std::ofstream log;
+    std::streambuf* original;       // std::cout's own buffer, put back by end()
+    std::chrono::steady_clock::time_point start;
+    
+    AsyncOutput() : ring(RING_SIZE), head(0), tail(0), dropped(0), sleeping(false), logging(false),
+                    exiting(false), reopen(false), original(nullptr), start(std::chrono::steady_clock::now()) {}
+    
+    void begin() {
+        writer = std::thread(&AsyncOutput::drain, this);
+        original = std::cout.rdbuf(this);
+    }
+    
+    void end() {
+        publish();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            exiting = true;
+        }
+        wake.notify_one();
+        writer.join();
+        std::cout.rdbuf(original);
+    }
+    
+    // Wake the writer if it sleeps. The empty critical section orders this
+    // after its last look at the ring, so the notify cannot be missed.
+    void notify() {
+        if (!sleeping.load()) return;
+        { std::lock_guard<std::mutex> guard(lock); }
+        wake.notify_one();
+    }
+    
+    void openLog(const std::string& path) {
+        bool open = !path.empty() && path != "<empty>";
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            logPath = open ? path : "";
+            reopen = true;
+        }
+        logging = open;
+        wake.notify_one();
+    }
+    
+    std::string logLine(char direction, const char* text, size_t n) const {
+        long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        std::string entry = std::to_string(ms) + ' ' + direction + ' ';
+        entry.append(text, n);
+        if (!n || text[n - 1] != '\n') entry += '\n';
+        return entry;
+    }
+    
+    // Input side of the debug log, called by the UCI loop
+    void logInput(const std::string& command) {
+        if (!logging.load(std::memory_order_relaxed)) return;
+        std::string entry = logLine('>', command.data(), command.size());
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            inputLog += entry;
+        }
+        wake.notify_one();
+    }
+    
+    int overflow(int c) override {
+        if (c == EOF) return 0;
+        line += (char)c;
+        if (c == '\n') publish();
+        return c;
+    }
+    
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        line.append(s, n);
+        if (memchr(s, '\n', n)) publish();
+        return n;
+    }
+    
+    int sync() override {
+        publish();
+        return 0;
+    }
+    
+    // Move the finished lines into the ring and wake the writer
+    void publish() {
+        size_t end = line.find('\n');
+        if (end == std::string::npos) return;
+        if (dropped && line.compare(0, 9, "bestmove ") == 0) {
+            line.insert(0, "info string " + std::to_string(dropped) + " info lines dropped\n");
+            dropped = 0;
+        }
+        for (; end != std::string::npos; end = line.find('\n')) {
+            push(end + 1);
+            line.erase(0, end + 1);
+        }
+        notify();
+    }
+    
+    void push(size_t size) {
+        size_t h = head.load(std::memory_order_relaxed);
+        while (h + size - tail.load(std::memory_order_acquire) > RING_SIZE) {
+            if (line.compare(0, 5, "info ") == 0 && line.compare(0, 12, "info string ") != 0) {
+                dropped++;
+                return;
+            }
+            std::this_thread::yield();
+        }
+        for (size_t i = 0; i < size; i++) ring[(h + i) & (RING_SIZE - 1)] = line[i];
+        head.store(h + size); // Sequentially consistent, against the writer's sleeping flag
+    }
+    
+    void drain() {
+        std::vector<char> batch;
+        std::string entries;
+        while (true) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            bool exit = false, open = false;
+            std::string path;
+            {
+                // Sleep until there is output or something to log
+                std::unique_lock<std::mutex> guard(lock);
+                sleeping = true;
+                wake.wait(guard, [&] { return exiting || reopen || !inputLog.empty() || head.load() != t; });
+                sleeping = false;
+                entries.swap(inputLog);
+                inputLog.clear();
+                if (reopen) {
+                    open = true;
+                    path = logPath;
+                    reopen = false;
                 }
-            } else {
-                parsed_move = m;
-                return true;
+                exit = exiting;
+            }
+            
+            if (open) {
+                if (log.is_open()) log.close();
+                if (!path.empty()) log.open(path, std::ios::app);
+            }
+            size_t h = head.load(std::memory_order_acquire);
+            batch.resize(h - t);
+            for (size_t i = t; i < h; i++) batch[i - t] = ring[i & (RING_SIZE - 1)];
+            tail.store(h, std::memory_order_release);
+            if (!batch.empty()) {
+                fwrite(batch.data(), 1, batch.size(), stdout);
+                fflush(stdout);
             }
+            
+            if (log.is_open()) {
+                for (size_t i = 0, from = 0; i < batch.size(); i++) {
+                    if (batch[i] == '\n') {
+                        entries += logLine('<', batch.data() + from, i - from);
+                        from = i + 1;
+                    }
+                }
+                log << entries;
+                log.flush();
+            }
+            entries.clear();
+            if (exit && head.load() == h) return; // Exiting and drained
         }
     }
-    return false;
+} asyncOutput;
+
+// stdin is read on its own thread so a stop or quit can be seen while a
+// command still runs; the UCI loop takes the lines in order from the queue.
+struct InputReader {
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<std::string> lines;
+    bool closed;
+    
+    InputReader() : closed(false) {}
+    
+    static bool isStop(const std::string& line) {
+        return line == "stop" || line == "quit";
+    }
+    
+    // The thread may be blocked in getline at exit, so it is detached
+    void begin() {
+        std::thread([this] {
+            std::string line;
+            while (std::getline(std::cin, line)) {
+                std::lock_guard<std::mutex> guard(lock);
+                if (isStop(line)) pendingStops++;
+                lines.push_back(line);
+                ready.notify_one();
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+            ready.notify_one();
+        }).detach();
+    }
+    
+    // Next line, or false once stdin is closed and the queue is empty
+    bool next(std::string& line) {
+        std::unique_lock<std::mutex> guard(lock);
+        ready.wait(guard, [&] { return closed || !lines.empty(); });
+        if (lines.empty()) return false;
+        line = lines.front();
+        lines.pop_front();
+        if (isStop(line)) pendingStops--;
+        return true;
+    }
+} inputReader;
+
+// Memory accounting. For each table: bytes allocated, and bytes touched,
+// i.e. resident in RAM as mincore() reports it. Pages never written are
+// not resident, so a fresh table costs address space but not memory.
+size_t residentBytes(const void* p, size_t bytes) {
+#ifndef _WIN32
+    if (!p || !bytes) return 0;
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t)p & ~(page - 1), end = (uintptr_t)p + bytes;
+    std::vector<unsigned char> pages((end - begin + page - 1) / page);
+    if (mincore((void*)begin, end - begin, pages.data()) != 0) return bytes;
+    size_t count = 0;
+    for (unsigned char c : pages) count += c & 1;
+    return std::min(bytes, count * page);
+#else
+    (void)p;
+    return bytes; // Unknown: counted as touched
+#endif
 }
 
-int main() {
-    initTables();
+// A field of /proc/self/status such as VmHWM, in bytes (0 if unavailable)
+U64 procStatus(const std::string& field) {
+    std::ifstream status("/proc/self/status");
+    std::string key;
+    U64 kb = 0;
+    while (status >> key) {
+        if (key == field + ":") {
+            status >> kb;
+            break;
+        }
+        status.ignore(256, '\n');
+    }
+    return kb << 10;
+}
+
+struct MemoryUsage {
+    const char* name;
+    size_t allocated, touched;
+    const char* note;
+    bool transient; // Allocated only while needed; allocated is the most it takes
+};
+
+// Heap bytes of one unordered_map entry: the node (next pointer and the
+// key-value pair, rounded up to malloc's 16-byte chunks with their 8-byte
+// header). The bucket array is counted apart.
+template <typename Map>
+size_t mapNodeBytes() {
+    return (sizeof(void*) + sizeof(typename Map::value_type) + 8 + 15) / 16 * 16;
+}
+
+std::vector<MemoryUsage> memoryUsage() {
+    std::vector<MemoryUsage> tables;
+    tables.push_back({"tt", ttBytes(), residentBytes(transpositionTable, ttBytes()),
+                      ttShared ? "shared segment" : "private", false});
+    
+    // Thread-local tables: each pool thread measures its own copy
+    int threads = threadPool.size;
+    std::vector<size_t> history(threads), killers(threads), correction(threads), l1(threads), stacks(threads);
+    std::vector<size_t> stackSizes(threads);
+    runOnPool([&](int index, int) {
+        history[index] = residentBytes(&historyTable, sizeof(HistoryTable));
+        killers[index] = residentBytes(&killerMoves, sizeof(KillerMoves));
+        correction[index] = residentBytes(&correctionHistory, sizeof(CorrectionHistory));
+        l1[index] = residentBytes(l1Table, sizeof(L1Table));
+#ifdef __linux__
+        pthread_attr_t attr;
+        void* base;
+        if (index > 0 && pthread_getattr_np(pthread_self(), &attr) == 0) {
+            if (pthread_attr_getstack(&attr, &base, &stackSizes[index]) == 0)
+                stacks[index] = residentBytes(base, stackSizes[index]);
+            pthread_attr_destroy(&attr);
+        }
+#endif
+    });
+    auto sum = [](const std::vector<size_t>& v) { size_t s = 0; for (size_t x : v) s += x; return s; };
+    tables.push_back({"history", threads * sizeof(HistoryTable), sum(history), "per thread", false});
+    tables.push_back({"killers", threads * sizeof(KillerMoves), sum(killers), "per thread", false});
+    tables.push_back({"correction", threads * sizeof(CorrectionHistory), sum(correction), "per thread, by pawn key",
+                      false});
+    size_t l1Count = 0;
+    for (int i = 0; i < MAX_THREADS; i++) l1Count += l1Tables[i] != nullptr;
+    tables.push_back({"l1 tt", l1Count * sizeof(L1Table), sum(l1), l1Depth ? "per thread" : "off", false});
+    tables.push_back({"thread stats", sizeof(threadStats), residentBytes(threadStats, sizeof(threadStats)), "",
+                      false});
+    tables.push_back({"output ring", AsyncOutput::RING_SIZE,
+                      residentBytes(asyncOutput.ring.data(), AsyncOutput::RING_SIZE), "", false});
+    
+    // Overlay buckets stay allocated once a Deterministic search made them;
+    // the nodes are freed by every commit
+    size_t buckets = 0;
+    for (int i = 0; i < MAX_THREADS; i++) {
+        if (ttOverlays[i].bucket_count() > 1) buckets += ttOverlays[i].bucket_count() * sizeof(void*); // 1: built in
+    }
+    if (buckets) tables.push_back({"tt overlay buckets", buckets, buckets, "per thread", false});
+    
+    size_t mateBytes = sizeof(MateSolver::Entry) << MateSolver::TABLE_BITS;
+    if (mateSolver) {
+        tables.push_back({"mate solver", mateBytes, residentBytes(mateSolver->table.data(), mateBytes), "go mate",
+                          false});
+    }
+    
+    // Helper stacks live as long as the pool: reserved, touched as deep as searches went
+    size_t stack = 0;
+#ifndef _WIN32
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_getstacksize(&attr, &stack);
+    pthread_attr_destroy(&attr);
+#endif
+    for (int i = 1; i < threads; i++) stackSizes[i] = stackSizes[i] ? stackSizes[i] : stack;
+    tables.push_back({"helper stacks", sum(stackSizes), sum(stacks), "per helper thread", false});
+    
+    // Allocated only while a search needs them
+    if (uciOptions.deterministic) {
+        // Up to the limit of nodes per thread, twice the bucket pointers
+        // for a table that doubles as it grows, and the sorted copy ttCommit makes
+        size_t perEntry = mapNodeBytes<TTOverlay>() + 2 * sizeof(void*);
+        tables.push_back({"tt overlays", threads * TT_OVERLAY_LIMIT * perEntry +
+                          TT_OVERLAY_LIMIT * sizeof(std::pair<U64, U64>), 0, "Deterministic searches, buckets then kept", true});
+    }
+    if (!mateSolver) tables.push_back({"mate solver", mateBytes, 0, "first go mate, then kept", true});
+    return tables;
+}
+
+void memstats() {
+    size_t allocated = 0, touched = 0;
+    for (const MemoryUsage& t : memoryUsage()) {
+        std::cout << "info string memory " << t.name;
+        if (t.transient) {
+            std::cout << " up to " << (t.allocated >> 10) << " KB (" << t.note << ")\n";
+            continue;
+        }
+        std::cout << " allocated " << (t.allocated >> 10) << " KB touched " << (t.touched >> 10) << " KB"
+                  << (*t.note ? " (" : "") << t.note << (*t.note ? ")" : "") << "\n";
+        allocated += t.allocated;
+        touched += t.touched;
+    }
+    std::cout << "info string memory tables allocated " << (allocated >> 10) << " KB touched " << (touched >> 10)
+              << " KB process rss " << (procStatus("VmRSS") >> 10) << " KB peak " << (procStatus("VmHWM") >> 10)
+              << " KB virtual " << (procStatus("VmSize") >> 10) << " KB\n";
+}
+
+// Limits of the last go, for replay to judge the time it took
+struct GoLimits {
+    int moveTime;  // movetime asked for (0: none)
+    int clock;     // Time left for the side to move (0: none)
+    int allocated; // What the time management gave itself
+} lastGo;
+
+bool uciCommand(Board& board, const std::string& line);
+
+// Swallows the engine's output while a transcript is replayed
+struct NullBuffer : std::streambuf {
+    int overflow(int c) { return c; }
+};
+
+// Nearest-rank percentile of sorted samples
+long long percentile(const std::vector<long long>& sorted, int p) {
+    if (sorted.empty()) return 0;
+    size_t rank = (sorted.size() * p + 99) / 100;
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+void reportLatency(const char* name, std::vector<long long>& us) {
+    std::sort(us.begin(), us.end());
+    std::cout << name << " count " << us.size();
+    if (!us.empty()) {
+        std::cout << " p50 " << percentile(us, 50) << " us p95 " << percentile(us, 95) << " us p99 "
+                  << percentile(us, 99) << " us max " << us.back() << " us";
+    }
+    std::cout << "\n";
+}
+
+// Feed a recorded UCI session to the engine with its original timing.
+// Lines are "[ms] [>|<][tag:] command": an optional timestamp in
+// milliseconds, then an optional direction, where '<' (engine output) is
+// skipped and a tag such as ">Engine(0):" is dropped. Lines without a
+// timestamp are sent at once, as are all of them when fast is set.
+// Latency runs from when the transcript sent a command, so an isready
+// sent during a search waits for it as it did in the session. A recorded
+// stop ends the go before it at the stop's time.
+// The session runs on a fresh engine state and leaves none behind: the
+// options and search parameters it sets are put back afterwards, and the
+// hash and histories it filled are cleared as by ucinewgame. Commands
+// that reach outside the engine (cluster, ClusterPort, DebugLogFile) are
+// skipped.
+void replay(const std::string& path, bool fast) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cout << "info string cannot open " << path << "\n";
+        return;
+    }
+    
+    // The commands with their send times (-1: at once)
+    std::vector<std::pair<long long, std::string>> commands;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream iss(line);
+        std::string token, command;
+        long long ms = -1;
+        if (iss >> token && isdigit((unsigned char)token[0])) {
+            ms = std::atoll(token.c_str());
+            iss >> token;
+        }
+        if (token.empty() || token[0] == '<') continue;
+        if (token[0] == '>') {
+            token.erase(0, 1);
+            if (!token.empty() && token.back() == ':') token.clear();
+            else if (token.empty()) iss >> token;
+        }
+        std::getline(iss, command);
+        command = token + command;
+        if (command.find_first_not_of(" \t\r") == std::string::npos) continue;
+        commands.push_back(std::make_pair(fast ? -1 : ms, command));
+    }
+    
+    UCIOptions savedOptions = uciOptions;
+    SearchParams savedParams = searchParams;
+    int savedL1Depth = l1Depth;
+    long long savedNodes = availableNodes;
+    newGame();
+    availableNodes = 0;
+    
     Board board;
     board.init();
+    std::vector<long long> goUs, readyUs;
+    int overruns = 0, limited = 0, overBudget = 0, budgeted = 0;
+    long long firstMs = -1;
+    auto start = std::chrono::steady_clock::now();
+    NullBuffer sink;
+    std::streambuf* out = std::cout.rdbuf(&sink);
     
-    std::string line, cmd;
+    // When the transcript sent command i: a command waiting behind a
+    // search is already late by the time it runs
+    auto sendTime = [&](size_t i) {
+        long long ms = commands[i].first;
+        if (ms < 0) return std::chrono::steady_clock::now();
+        if (firstMs < 0) firstMs = ms;
+        return start + std::chrono::milliseconds(std::max(0LL, ms - firstMs));
+    };
+    auto command = [&](size_t i) {
+        std::istringstream words(commands[i].second);
+        std::string cmd;
+        words >> cmd;
+        return cmd;
+    };
     
-    while (std::getline(std::cin, line)) {
-        std::istringstream iss(line);
-        iss >> cmd;
+    for (size_t i = 0; i < commands.size(); i++) {
+        const std::string& text = commands[i].second;
+        std::string cmd = command(i);
+        if (cmd == "replay" || cmd == "cluster") continue;
+        if (cmd == "setoption" && (text.find("ClusterPort") != std::string::npos ||
+                                   text.find("DebugLogFile") != std::string::npos)) continue;
         
-        if (cmd == "uci") {
-            std::cout << "id name NanoChessTurbo\n";
-            std::cout << "id author CrvProject\n";
-            std::cout << "option name Depth type spin default 10 min 1 max 30\n";
-            std::cout << "option name Hash type spin default 64 min 1 max 1024\n";
-            std::cout << "uciok\n";
-        }
-        else if (cmd == "setoption") {
-            std::string token;
-            iss >> token; // "name"
-            if (token == "name") {
-                std::string optionName;
-                iss >> optionName;
-                
-                std::string nextToken;
-                while (iss >> nextToken && nextToken != "value") {
-                    optionName += nextToken;
-                }
-                
-                if (optionName == "Depth") {
-                    int value;
-                    iss >> value;
-                    uciOptions.depth = std::max(1, std::min(30, value));
-                }
-                else if (optionName == "Hash") {
-                    int value;
-                    iss >> value;
-                    // Could resize TT here if needed
+        auto sent = sendTime(i);
+        std::this_thread::sleep_until(sent);
+        
+        // The stop recorded for this go is delivered at its own time, as a
+        // queued stop from the GUI would be
+        size_t stop = i + 1;
+        while (cmd == "go" && stop < commands.size() && command(stop) != "stop" && command(stop) != "go") stop++;
+        std::thread stopper;
+        std::mutex stopLock;
+        std::condition_variable stopWake;
+        bool finished = false, delivered = false;
+        if (cmd == "go" && stop < commands.size() && command(stop) == "stop") {
+            auto stopAt = sendTime(stop);
+            stopper = std::thread([&] {
+                std::unique_lock<std::mutex> guard(stopLock);
+                if (!stopWake.wait_until(guard, stopAt, [&] { return finished; })) {
+                    pendingStops++;
+                    delivered = true;
                 }
+            });
+        }
+        
+        bool more = uciCommand(board, text);
+        long long us = microsSince(sent);
+        
+        if (stopper.joinable()) {
+            {
+                std::lock_guard<std::mutex> guard(stopLock);
+                finished = true;
+            }
+            stopWake.notify_one();
+            stopper.join();
+            if (delivered) pendingStops--;
+        }
+        
+        if (cmd == "isready") readyUs.push_back(us);
+        if (cmd == "go") {
+            goUs.push_back(us);
+            int limit = lastGo.moveTime ? lastGo.moveTime : lastGo.clock;
+            if (limit > 0) {
+                limited++;
+                if (us > limit * 1000LL) overruns++;
             }
+            if (lastGo.allocated > 0) {
+                budgeted++;
+                if (us > lastGo.allocated * 1000LL) overBudget++;
+            }
+        }
+        if (!more) break;
+    }
+    
+    std::cout.rdbuf(out);
+    
+    // Put the session's settings back
+    bool hashChanged = uciOptions.hashMB != savedOptions.hashMB || uciOptions.sharedHash != savedOptions.sharedHash ||
+                       uciOptions.autoHash != savedOptions.autoHash ||
+                       uciOptions.autoHashPercent != savedOptions.autoHashPercent;
+    bool threadsChanged = uciOptions.threads != savedOptions.threads;
+    uciOptions = savedOptions;
+    searchParams = savedParams;
+    if (threadsChanged) threadPool.resize(uciOptions.threads);
+    if (hashChanged) applyHash();
+    if (l1Depth != savedL1Depth) l1Setup(savedL1Depth);
+    newGame();
+    availableNodes = savedNodes;
+    
+    std::cout << "Replay of " << path << " (" << microsSince(start) / 1000 << " ms)\n";
+    reportLatency("go->bestmove   :", goUs);
+    reportLatency("isready        :", readyUs);
+    std::cout << "Overruns       : " << overruns << "/" << limited << " over movetime or clock ("
+              << (limited ? 100.0 * overruns / limited : 0.0) << "%), " << overBudget << "/" << budgeted
+              << " over the allocated time\n";
+}
+
+// Mean and 95% confidence half-width (Student's t) of repeated samples
+void confidence(const std::vector<double>& samples, double& mean, double& halfWidth) {
+    static const double T95[] = {0, 12.71, 4.30, 3.18, 2.78, 2.57, 2.45, 2.36, 2.31, 2.26};
+    size_t n = samples.size();
+    mean = 0;
+    for (double x : samples) mean += x;
+    mean /= n;
+    double var = 0;
+    for (double x : samples) var += (x - mean) * (x - mean);
+    halfWidth = n > 1 ? (n - 1 < 10 ? T95[n - 1] : 1.96) * std::sqrt(var / (n - 1) / n) : 0;
+}
+
+// Thread scaling. The bench positions are searched to a fixed depth at
+// 1, 2, 4, ... up to maxThreads threads, the levels interleaved within
+// each round so drift in machine load hits all of them alike. The depth
+// is calibrated so that all rounds at one thread would fit the budget.
+// Per level: NPS, efficiency (NPS per thread against one thread),
+// time-to-depth speedup, node overhead and TT hit rate, each with a 95%
+// confidence interval over the rounds.
+void speedtest(int seconds, int maxThreads) {
+    const int ROUNDS = 5;
+    std::vector<int> levels;
+    for (int t = 1; t < maxThreads; t *= 2) levels.push_back(t);
+    levels.push_back(maxThreads);
+    int savedThreads = threadPool.size;
+    int count = sizeof(benchPositions) / sizeof(benchPositions[0]);
+    
+    NullBuffer sink;
+    std::streambuf* out = std::cout.rdbuf(&sink);
+    // One pass over the positions: time in ms, nodes, TT hits
+    auto pass = [&](int threads, int depth, double& ms, double& nodes, double& hits) {
+        threadPool.resize(threads);
+        ms = nodes = hits = 0;
+        for (int i = 0; i < count; i++) {
+            Board b;
+            b.setFen(benchPositions[i]);
+            newGame();
+            Move bestMove;
+            auto start = std::chrono::steady_clock::now();
+            thinkLocal(b, depth, bestMove, 0);
+            ms += microsSince(start) / 1000.0;
+            nodes += searchStats.nodes() + searchStats.qnodes();
+            hits += searchStats.ttHits();
         }
-        else if (cmd == "isready") {
-            std::cout << "readyok\n";
+    };
+    
+    // Calibration comes out of the budget: go one depth deeper only while
+    // that pass and all the rounds at its depth still fit in what is left.
+    // Passes are costed by wall time, table clearing included; each depth
+    // costs at least 2.5 times the one before, more if the last two say so.
+    auto begin = std::chrono::steady_clock::now();
+    int depth = 5;
+    double ms, nodes, hits, growth = 2.5;
+    pass(1, depth, ms, nodes, hits);
+    double wall = microsSince(begin) / 1000.0;
+    while (depth < 30 && microsSince(begin) / 1000.0 + wall * growth * (1 + ROUNDS * levels.size()) <= seconds * 1000.0) {
+        auto started = std::chrono::steady_clock::now();
+        pass(1, ++depth, ms, nodes, hits);
+        double last = wall;
+        wall = microsSince(started) / 1000.0;
+        growth = std::max(2.5, wall / std::max(last, 1.0));
+    }
+    long long calibrationMs = microsSince(begin) / 1000;
+    
+    std::vector<std::vector<double>> nps(levels.size()), time(levels.size()), total(levels.size()), hitRate(levels.size());
+    for (int round = 0; round < ROUNDS; round++) {
+        for (size_t l = 0; l < levels.size(); l++) {
+            pass(levels[l], depth, ms, nodes, hits);
+            nps[l].push_back(nodes * 1000 / std::max(ms, 1.0));
+            time[l].push_back(ms);
+            total[l].push_back(nodes);
+            hitRate[l].push_back(100 * hits / std::max(nodes, 1.0));
         }
-        else if (cmd == "ucinewgame") {
-            board.init();
-            historyTable.init();
-            killerMoves.init();
-            memset(transpositionTable, 0, sizeof(transpositionTable));
+    }
+    std::cout.rdbuf(out);
+    threadPool.resize(savedThreads);
+    
+    std::cout << "Speedtest: " << count << " positions, depth " << depth << ", " << ROUNDS
+              << " rounds, 95% confidence intervals, " << microsSince(begin) / 1000 << " ms (calibration "
+              << calibrationMs << " ms)\n";
+    std::cout << "threads          nps      +-   efficiency  ttd speedup     +-  node overhead  tt hit %\n";
+    double base, baseHalf, baseTime, baseNodes, half;
+    confidence(nps[0], base, baseHalf);
+    confidence(time[0], baseTime, half);
+    confidence(total[0], baseNodes, half);
+    for (size_t l = 0; l < levels.size(); l++) {
+        // Speedup per round, against the one-thread pass of the same round
+        std::vector<double> speedup;
+        for (int round = 0; round < ROUNDS; round++) speedup.push_back(time[0][round] / time[l][round]);
+        double rate, rateHalf, up, upHalf, levelNodes, hit;
+        confidence(nps[l], rate, rateHalf);
+        confidence(speedup, up, upHalf);
+        confidence(total[l], levelNodes, half);
+        confidence(hitRate[l], hit, half);
+        char line[160];
+        snprintf(line, sizeof(line), "%7d %12.0f %7.0f %10.1f%% %12.2f %6.2f %13.2f %9.1f\n", levels[l], rate,
+                 rateHalf, 100 * rate / (base * levels[l]), up, upHalf, levelNodes / baseNodes, hit);
+        std::cout << line;
+    }
+}
+
+// Run one UCI command line; false once the engine should quit
+bool uciCommand(Board& board, const std::string& line) {
+    std::istringstream iss(line);
+    std::string cmd;
+    iss >> cmd;
+    
+    if (cmd == "uci") {
+        std::cout << "id name NanoChessTurbo\n";
+        std::cout << "id author CrvProject\n";
+        std::cout << "option name Depth type spin default 10 min 1 max 30\n";
+        std::cout << "option name Hash type spin default 64 min 1 max 1024\n";
+        std::cout << "option name Threads type spin default 1 min 1 max " << MAX_THREADS << "\n";
+        std::cout << "option name Deterministic type check default false\n";
+        std::cout << "option name SharedHash type check default false\n";
+        std::cout << "option name AutoHash type check default false\n";
+        std::cout << "option name L1HashDepth type spin default 0 min 0 max 8\n";
+        std::cout << "option name AutoHashPercent type spin default 50 min 1 max 90\n";
+        std::cout << "option name ClusterPort type spin default 0 min 0 max 65535\n";
+        std::cout << "option name ClusterBind type string default 127.0.0.1\n";
+        std::cout << "option name ClusterSecret type string default <empty>\n";
+        std::cout << "option name DebugLogFile type string default <empty>\n";
+        std::cout << "option name nodestime type spin default 0 min 0 max 100000\n";
+        std::cout << "option name BookFile type string default <empty>\n";
+        for (const ParamSpec& spec : paramSpecs) {
+            std::cout << "option name " << spec.name << " type spin default " << SearchParams().*spec.field
+                      << " min " << spec.min << " max " << spec.max << "\n";
         }
-        else if (cmd == "position") {
-            std::string token, sub_cmd;
-            iss >> sub_cmd;
+        std::cout << "uciok\n";
+    }
+    else if (cmd == "setoption") {
+        std::string token;
+        iss >> token; // "name"
+        if (token == "name") {
+            std::string optionName;
+            iss >> optionName;
             
-            if (sub_cmd == "startpos") {
-                board.init();
-                iss >> token;
-            } else if (sub_cmd == "fen") {
-                board.init();
-                while (iss >> token && token != "moves") {}
-            }
-
-            if (token == "moves") {
-                Move m;
-                while (iss >> token) {
-                    if (parseMove(board, token, m)) {
-                        makeMove(board, m);
-                    }
+            std::string nextToken;
+            while (iss >> nextToken && nextToken != "value") {
+                optionName += nextToken;
+            }
+            
+            if (optionName == "Depth") {
+                int value;
+                iss >> value;
+                uciOptions.depth = std::max(1, std::min(30, value));
+            }
+            else if (optionName == "Threads") {
+                int value;
+                iss >> value;
+                uciOptions.threads = std::max(1, std::min(MAX_THREADS, value));
+                threadPool.resize(uciOptions.threads);
+            }
+            else if (optionName == "Deterministic") {
+                std::string value;
+                iss >> value;
+                uciOptions.deterministic = (value == "true");
+            }
+            else if (optionName == "Hash") {
+                int value;
+                iss >> value;
+                uciOptions.hashMB = std::max(1, std::min(1024, value));
+                applyHash();
+            }
+            else if (optionName == "nodestime") {
+                int value;
+                iss >> value;
+                uciOptions.nodesTime = std::max(0, std::min(100000, value));
+                availableNodes = 0;
+            }
+            else if (optionName == "BookFile") {
+                std::getline(iss >> std::ws, uciOptions.bookFile);
+                if (uciOptions.bookFile == "<empty>") uciOptions.bookFile.clear();
+            }
+            else if (optionName == "DebugLogFile") {
+                std::string path;
+                std::getline(iss >> std::ws, path);
+                asyncOutput.openLog(path);
+            }
+            else if (optionName == "ClusterBind") {
+                iss >> clusterBind;
+            }
+            else if (optionName == "ClusterSecret") {
+                clusterSecret.clear();
+                iss >> clusterSecret;
+                if (clusterSecret == "<empty>") clusterSecret.clear();
+            }
+            else if (optionName == "ClusterPort") {
+                int value;
+                iss >> value;
+                if (!clusterListen(value)) {
+                    std::cout << "info string cannot listen on port " << value << "\n";
                 }
             }
+            else if (optionName == "SharedHash") {
+                std::string value;
+                iss >> value;
+                uciOptions.sharedHash = (value == "true");
+                applyHash();
+            }
+            else if (optionName == "L1HashDepth") {
+                int value;
+                iss >> value;
+                l1Setup(std::max(0, std::min(8, value)));
+            }
+            else if (optionName == "AutoHash") {
+                std::string value;
+                iss >> value;
+                uciOptions.autoHash = (value == "true");
+                applyHash();
+            }
+            else if (optionName == "AutoHashPercent") {
+                int value;
+                iss >> value;
+                uciOptions.autoHashPercent = std::max(1, std::min(90, value));
+                if (uciOptions.autoHash) applyHash();
+            }
+            else {
+                setParam(optionName, iss);
+            }
         }
-        else if (cmd == "go") {
-            int searchDepth = uciOptions.depth;
-            int moveTime = 0;
-            int wtime = 0, btime = 0, winc = 0, binc = 0;
-            int movestogo = 40;
-            bool infinite = false;
-            
-            std::string token;
+    }
+    else if (cmd == "isready") {
+        std::cout << "info string memory rss " << (procStatus("VmRSS") >> 10) << " KB peak "
+                  << (procStatus("VmHWM") >> 10) << " KB tt " << (ttBytes() >> 10) << " KB touched "
+                  << (residentBytes(transpositionTable, ttBytes()) >> 10) << " KB\n";
+        std::cout << "readyok\n";
+    }
+    else if (cmd == "cluster") {
+        std::string host, port, secret;
+        iss >> host >> port >> secret;
+        clusterWorker(host, port, secret);
+    }
+    else if (cmd == "ucinewgame") {
+        board.init();
+        newGame();
+        availableNodes = 0;
+    }
+    else if (cmd == "position") {
+        std::string token, sub_cmd;
+        iss >> sub_cmd;
+        
+        if (sub_cmd == "startpos") {
+            board.init();
+            iss >> token;
+        } else if (sub_cmd == "fen") {
+            std::string fen;
+            while (iss >> token && token != "moves") {
+                fen += token + " ";
+            }
+            board.setFen(fen);
+        }
+
+        if (token == "moves") {
+            Move m;
             while (iss >> token) {
-                if (token == "depth") {
-                    iss >> searchDepth;
-                    searchDepth = std::max(1, std::min(30, searchDepth));
-                }
-                else if (token == "movetime") {
-                    iss >> moveTime;
-                }
-                else if (token == "wtime") {
-                    iss >> wtime;
-                }
-                else if (token == "btime") {
-                    iss >> btime;
-                }
-                else if (token == "winc") {
-                    iss >> winc;
-                }
-                else if (token == "binc") {
-                    iss >> binc;
-                }
-                else if (token == "movestogo") {
-                    iss >> movestogo;
-                }
-                else if (token == "infinite") {
-                    infinite = true;
-                    searchDepth = 20;
+                if (parseMove(board, token, m)) {
+                    makeMove(board, m);
                 }
             }
-            
-            // Time allocation
-            int allocatedTime = 0;
-            if (!infinite && moveTime == 0 && (wtime > 0 || btime > 0)) {
-                int timeLeft = (board.side == WHITE) ? wtime : btime;
-                int increment = (board.side == WHITE) ? winc : binc;
-                
-                allocatedTime = timeLeft / movestogo + increment * 0.8;
-                allocatedTime = std::min(allocatedTime, timeLeft / 3);
-            } else if (moveTime > 0) {
-                allocatedTime = moveTime * 0.95;
+        }
+    }
+    else if (cmd == "go") {
+        int searchDepth = uciOptions.depth;
+        int moveTime = 0;
+        int wtime = 0, btime = 0, winc = 0, binc = 0;
+        int movestogo = 40;
+        int mateMoves = 0;
+        bool infinite = false;
+        
+        std::string token;
+        while (iss >> token) {
+            if (token == "depth") {
+                iss >> searchDepth;
+                searchDepth = std::max(1, std::min(30, searchDepth));
+            }
+            else if (token == "movetime") {
+                iss >> moveTime;
+            }
+            else if (token == "wtime") {
+                iss >> wtime;
             }
+            else if (token == "btime") {
+                iss >> btime;
+            }
+            else if (token == "winc") {
+                iss >> winc;
+            }
+            else if (token == "binc") {
+                iss >> binc;
+            }
+            else if (token == "movestogo") {
+                iss >> movestogo;
+            }
+            else if (token == "infinite") {
+                infinite = true;
+                searchDepth = 20;
+            }
+            else if (token == "mate") {
+                iss >> mateMoves;
+            }
+        }
+        lastGo.moveTime = infinite ? 0 : moveTime;
+        lastGo.clock = infinite ? 0 : (board.side == WHITE ? wtime : btime);
+        lastGo.allocated = 0;
+        
+        // Time allocation
+        int allocatedTime = 0;
+        int increment = 0;
+        int nodesPerMs = 0;
+        if (!infinite && moveTime == 0 && (wtime > 0 || btime > 0)) {
+            int timeLeft = (board.side == WHITE) ? wtime : btime;
+            increment = (board.side == WHITE) ? winc : binc;
             
-            Move bestMove;
-            iterativeDeepening(board, searchDepth, bestMove, allocatedTime);
+            // nodestime: what is left is the node bank, in ms at the set rate
+            if (uciOptions.nodesTime) {
+                if (!availableNodes) availableNodes = (long long)timeLeft * uciOptions.nodesTime;
+                timeLeft = (int)std::min<long long>(availableNodes / uciOptions.nodesTime, 1 << 30);
+                nodesPerMs = uciOptions.nodesTime;
+            }
             
-            // Output best move
-            if (bestMove.from != bestMove.to || bestMove.from != 0) {
-                std::string move_str;
-                move_str += (bestMove.from % 8) + 'a';
-                move_str += (bestMove.from / 8) + '1';
-                move_str += (bestMove.to % 8) + 'a';
-                move_str += (bestMove.to / 8) + '1';
-                if (bestMove.promo) {
-                    switch (bestMove.promo) {
-                        case QUEEN: move_str += 'q'; break;
-                        case ROOK: move_str += 'r'; break;
-                        case BISHOP: move_str += 'b'; break;
-                        case KNIGHT: move_str += 'n'; break;
-                    }
-                }
-                
-                std::cout << "bestmove " << move_str << "\n";
+            allocatedTime = timeLeft / movestogo + increment * 0.8;
+            allocatedTime = std::max(1, std::min(allocatedTime, timeLeft / 3)); // 0 would mean no limit
+        } else if (moveTime > 0) {
+            allocatedTime = moveTime * 0.95;
+        }
+        lastGo.allocated = allocatedTime;
+        
+        // A book move is played at once; analysis and mate searches skip the book
+        Move bookHit;
+        if (!uciOptions.bookFile.empty() && !infinite && !mateMoves && bookProbe(board, bookHit)) {
+            searchStats.init();
+            std::cout << "info string book move\n";
+            std::cout << "bestmove " << moveToString(bookHit) << "\n";
+            return true;
+        }
+        
+        // Mate search gets half the time: a proven mate answers at once,
+        // else the normal search has what is left (a stop leaves depth 1).
+        // The clock runs on nodes for this go only.
+        Move bestMove;
+        int mateMs = 0;
+        clockNodesPerMs = nodesPerMs;
+        stopArmed = true;
+        bool mated = mateMoves > 0 && mateSearch(board, mateMoves, bestMove, allocatedTime / 2, mateMs);
+        if (mated) {
+            searchStats.init();
+        } else {
+            if (mateMoves > 0 && pendingStops.load()) searchDepth = 1;
+            think(board, searchDepth, bestMove, allocatedTime ? std::max(1, allocatedTime - mateMs) : 0);
+        }
+        
+        if (clockNodesPerMs) {
+            availableNodes += (long long)increment * clockNodesPerMs - searchStats.nodes() - searchStats.qnodes()
+                              - (long long)mateMs * clockNodesPerMs;
+            availableNodes = std::max(1LL, availableNodes); // 0 would restart the bank
+        }
+        clockNodesPerMs = 0;
+        stopArmed = false;
+        
+        // Output best move
+        if (bestMove.from != bestMove.to || bestMove.from != 0) {
+            std::cout << "bestmove " << moveToString(bestMove) << "\n";
+        } else {
+            auto moves = generateMoves(board);
+            if (!moves.empty()) {
+                std::cout << "bestmove " << moveToString(moves[0]) << "\n";
             } else {
-                auto moves = generateMoves(board);
-                if (!moves.empty()) {
-                    Move fallback = moves[0];
-                    std::string move_str;
-                    move_str += (fallback.from % 8) + 'a';
-                    move_str += (fallback.from / 8) + '1';
-                    move_str += (fallback.to % 8) + 'a';
-                    move_str += (fallback.to / 8) + '1';
-                    if (fallback.promo) {
-                        switch (fallback.promo) {
-                            case QUEEN: move_str += 'q'; break;
-                            case ROOK: move_str += 'r'; break;
-                            case BISHOP: move_str += 'b'; break;
-                            case KNIGHT: move_str += 'n'; break;
-                        }
-                    }
-                    std::cout << "bestmove " << move_str << "\n";
-                } else {
-                    std::cout << "bestmove 0000\n";
-                }
+                std::cout << "bestmove 0000\n";
             }
         }
-        else if (cmd == "quit") {
-            break;
-        }
     }
+    else if (cmd == "perft") {
+        int depth = 5;
+        iss >> depth;
+        runPerft(board, std::max(1, depth));
+    }
+    else if (cmd == "batch") {
+        std::string path;
+        int depth = uciOptions.depth;
+        long long slice = 20000;
+        iss >> path >> depth >> slice;
+        batch(path, std::max(1, std::min(30, depth)), std::max(1LL, slice));
+    }
+    else if (cmd == "replay") {
+        std::string path, mode;
+        iss >> path >> mode;
+        replay(path, mode == "fast");
+    }
+    else if (cmd == "spsa") {
+        int pairs = 10000;
+        long long nodes = 3000;
+        std::string path = "spsa.txt";
+        iss >> pairs >> nodes >> path;
+        spsa(std::max(1, pairs), std::max(1LL, nodes), path);
+    }
+    else if (cmd == "makebook") {
+        std::string pgn, out;
+        int plies = 40;
+        iss >> pgn >> out >> plies;
+        makeBook(pgn, out, std::max(1, plies));
+    }
+    else if (cmd == "memstats") {
+        memstats();
+    }
+    else if (cmd == "speedtest") {
+        int seconds = 60;
+        int cores = std::max(1, (int)std::thread::hardware_concurrency());
+        iss >> seconds >> cores;
+        speedtest(std::max(1, seconds), std::max(1, std::min(MAX_THREADS, cores)));
+    }
+    else if (cmd == "bench") {
+        int depth = 9;
+        iss >> depth;
+        bench(depth);
+    }
+    else if (cmd == "quit") {
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    initTables();
+    applyHash();
+    Board board;
+    board.init();
+    
+    asyncOutput.begin();
+    inputReader.begin();
+    std::string line;
+    while (inputReader.next(line)) {
+        asyncOutput.logInput(line);
+        if (!uciCommand(board, line)) break;
+    }
+    asyncOutput.end();
     
+    clusterClose();
+    threadPool.resize(1);
+    ttRelease();
     return 0;
-}
\ No newline at end of file
+}